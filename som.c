@@ -27,18 +27,33 @@
 #include "libbfd.h"
 #include "som.h"
 #include "safe-ctype.h"
+#include "hashtab.h"
 #include "som/reloc.h"
 #include "aout/ar.h"
 
+struct fixup_format;
+
 static bfd_reloc_status_type hppa_som_reloc
   (bfd *, arelent *, asymbol *, void *, asection *, bfd *, char **);
 static bool som_mkobject (bfd *);
 static bool som_is_space (asection *);
 static bool som_is_subspace (asection *);
 static int compare_subspaces (const void *, const void *);
+static int compare_subspace_ranges (const void *, const void *);
 static uint32_t som_compute_checksum (struct som_external_header *);
 static bool som_build_and_write_symbol_table (bfd *);
 static unsigned int som_slurp_symbol_table (bfd *);
+static bool som_decode_fixup_fast (unsigned int, const struct fixup_format *,
+				   unsigned char **, unsigned char *, int *,
+				   arelent *, asymbol **, unsigned int, bool,
+				   unsigned int *, int *);
+static bool som_flush_contents (bfd *);
+static unsigned int som_bfd_ar_symbol_hash (asymbol *);
+static unsigned int som_ar_name_hash (const char *, unsigned int);
+static void som_free_contents (bfd *);
+static bool som_get_section_contents (bfd *, sec_ptr, void *, file_ptr,
+				      bfd_size_type);
+static void som_free_page_cache (bfd *);
 
 /* Magic not defined in standard HP-UX header files until 8.0.  */
 
@@ -96,8 +111,20 @@ static unsigned int som_slurp_symbol_table (bfd *);
 
 #define SOM_TMP_BUFSIZE 8192
 
-/* Size of the hash table in archives.  */
+/* Smallest size of the hash table in archives, and the average chain
+   length aimed for when choosing a larger one.  */
 #define SOM_LST_HASH_SIZE 31
+#define SOM_LST_HASH_LOAD 2
+
+/* Largest hash table bfd_som_set_lst_hash_size accepts, keeping the
+   table's 4 bytes per bucket well within the 32-bit LST offsets.  */
+#define SOM_LST_HASH_SIZE_MAX 0x1000000
+
+/* Environment variable naming a directory in which som_slurp_armap
+   may keep decoded archive maps between runs, and the tag that
+   starts each such cache file.  */
+#define SOM_ARMAP_CACHE_ENV "BFD_SOM_ARMAP_CACHE"
+#define SOM_ARMAP_CACHE_MAGIC "SOMARMC2"
 
 /* Max number of SOMs to be found in an archive.  */
 #define SOM_LST_MODULE_LIMIT 1024
@@ -112,12 +139,18 @@ static unsigned int som_slurp_symbol_table (bfd *);
    of some multi-byte relocation makes object files smaller.
 
    Note one side effect of using a R_PREV_FIXUP is the relocation that
-   is being repeated moves to the front of the queue.  */
-static struct reloc_queue
+   is being repeated moves to the front of the queue.
+
+   Each fixup stream being read or written has its own queue, living in
+   the frame of the routine doing the work, so fixups for different
+   BFDs may be processed concurrently.  */
+#define QUEUE_SIZE 4
+
+struct reloc_queue
 {
   unsigned char *reloc;
   unsigned int size;
-} reloc_queue[4];
+};
 
 /* This fully describes the symbol types which may be attached to
    an EXPORT or IMPORT directive.  Only SOM uses this formation
@@ -157,6 +190,311 @@ struct som_misc_symbol_info
   unsigned int dup_common;
 };
 
+/* Per-section data private to this file.  The public part from som.h
+   must come first so that som_section_data keeps working on it.  */
+struct som_private_section_data
+{
+  struct som_section_data_struct root;
+
+  /* When the fixup stream in ROOT.reloc_stream was read by
+     som_read_temporary, the base address and size needed to release
+     it again.  */
+  void *reloc_stream_map;
+  size_t reloc_stream_map_size;
+
+  /* Storage for ROOT.copy_data and for whichever of ROOT.space_dict
+     and ROOT.subspace_dict the section uses, so that they come with
+     the section rather than each needing an allocation of its own.  */
+  struct som_copyable_section_data_struct copy_data;
+  union
+  {
+    struct som_space_dictionary_record space;
+    struct som_subspace_dictionary_record subspace;
+  } dict;
+};
+
+#define som_private_section_data(sec) \
+  ((struct som_private_section_data *) (sec)->used_by_bfd)
+
+/* Return the copyable data of SECTION, pointing it at the storage
+   within the section's private data if it has none yet.  */
+
+static inline struct som_copyable_section_data_struct *
+som_get_copy_data (asection *section)
+{
+  struct som_private_section_data *sdata = som_private_section_data (section);
+
+  if (sdata->root.copy_data == NULL)
+    sdata->root.copy_data = &sdata->copy_data;
+  return sdata->root.copy_data;
+}
+
+/* One subspace in the address lookup table built by
+   assign_subspace_indices.  */
+struct som_subspace_range
+{
+  /* The subspace covers [VMA, END], END included.  */
+  bfd_vma vma;
+  bfd_vma end;
+
+  /* The largest END of this and every earlier entry in the table.  */
+  bfd_vma max_end;
+
+  /* Position of the subspace in the BFD's section list.  */
+  unsigned int list_pos;
+
+  asection *section;
+};
+
+/* A canonical symbol in the name index built by bfd_som_lookup_symbol.  */
+struct som_symbol_hash_entry
+{
+  /* htab_hash_string of the symbol's name.  */
+  unsigned int hash;
+
+  /* Next canonical symbol in the same bucket, or -1.  */
+  unsigned int next;
+};
+
+/* A function symbol in the address index used by som_find_nearest_line.  */
+struct som_func_entry
+{
+  unsigned int section_id;
+  bfd_vma value;
+
+  /* Position in the symbol table the index was built from.  */
+  unsigned int pos;
+
+  som_symbol_type *sym;
+};
+
+/* A space of an output BFD and its subspaces, in section list order.  */
+struct som_space_group
+{
+  asection *space;
+  asection **subspaces;
+  unsigned int count;
+};
+
+/* Subspace contents of an output BFD waiting to be written.  Writes
+   arriving in file order are gathered here so that the output sees
+   a few large sequential writes instead of a seek and a write per
+   bfd_set_section_contents call.  */
+struct som_content_buffer
+{
+  /* BUF holds USED bytes destined for file offset START.  */
+  bfd_byte *buf;
+  size_t used;
+  size_t size;
+  file_ptr start;
+
+  /* End of the furthest content written or buffered so far.  Nothing
+     else is ever written between it and som_length, so a gap starting
+     there may be zero filled rather than skipped over.  */
+  file_ptr high_water;
+};
+
+/* A page of an input BFD held by its contents cache.  DATA is NULL
+   for an unused slot; otherwise it holds the LEN bytes of the file
+   starting at POS, LEN being short only at the end of the file.  */
+struct som_cached_page
+{
+  file_ptr pos;
+  size_t len;
+  bfd_byte *data;
+};
+
+/* Recently read pages of an input BFD, serving the small section
+   content reads (relocation addends, stubs, unwind entries) that would
+   otherwise each cost a seek and a read.  Page N lives in slot N modulo
+   COUNT, so the memory used never exceeds COUNT pages.  The slots are
+   allocated on the first cached read, BUDGET bytes' worth of them.  */
+struct som_page_cache
+{
+  struct som_cached_page *slots;
+  size_t count;
+  size_t budget;
+};
+
+/* Size of the pages of an input BFD kept by its contents cache, and
+   the default amount of memory the cache of one BFD may use.  Reads
+   of more than a page go straight to the file.  */
+#define SOM_PAGE_CACHE_PAGE_SIZE 4096
+#define SOM_PAGE_CACHE_BUDGET (256 * 1024)
+
+/* An in-memory image of one of the metadata regions of an output BFD
+   (everything before the subspace contents, or everything after
+   them), built up by som_finish_writing and written out whole.  */
+struct som_output_image
+{
+  file_ptr start;
+  size_t size;
+  bfd_byte *buf;
+};
+
+/* SOM specific data of an archive, in its artdata tdata: what
+   som_slurp_armap keeps of the LST for bfd_som_find_archive_member,
+   and the settings for writing one.  */
+struct som_archive_data
+{
+  /* The whole LST member, which has been checked by som_slurp_armap.  */
+  const bfd_byte *lst;
+  size_t lst_size;
+  struct som_lst_header header;
+
+  /* Number of hash buckets set by bfd_som_set_lst_hash_size, or zero
+     to size the table from the symbol count.  */
+  unsigned int hash_size;
+
+  /* When the archive map came from the cache, without the LST, a name
+     index over it built by bfd_som_find_archive_member: bucket heads
+     (-1 for an empty bucket), a power of two of them, and the next
+     entry of each map entry's chain.  */
+  unsigned int *map_buckets;
+  unsigned int *map_chain;
+  unsigned int map_mask;
+};
+
+#ifdef SOM_STATS
+/* Counters and timers kept per BFD when the back end is built with
+   SOM_STATS defined, read by bfd_som_get_stat, bfd_som_get_fixup_stats
+   and bfd_som_print_stats.  Fixups are counted by relocation type,
+   which is what the opcodes of som_fixup_formats decode to.  Times
+   are processor time in microseconds, as from get_run_time.  */
+struct som_stats
+{
+  /* Reading.  */
+  unsigned long section_reads;
+  unsigned long bytes_read;
+  unsigned long seeks;
+  unsigned long page_cache_hits;
+  unsigned long page_cache_misses;
+  unsigned long symbols_decoded;
+  unsigned long fixups_decoded[256];
+
+  /* Writing.  */
+  unsigned long writes;
+  unsigned long bytes_written;
+  unsigned long fixups_encoded[256];
+  unsigned long queue_hits;
+  unsigned long queue_misses;
+  unsigned long begin_writing_time;
+  unsigned long finish_writing_time;
+  unsigned long encode_fixups_time;
+  unsigned long write_fixups_time;
+};
+#endif
+
+/* Likewise for the per-BFD data.  */
+struct som_private_data
+{
+  struct som_data_struct root;
+
+  /* The spaces of an output BFD in section list order, built by
+     som_prep_headers so the writers need not rescan the section list
+     for every space.  */
+  struct som_space_group *space_groups;
+  unsigned int space_group_count;
+
+  /* Subspace contents of an output BFD not yet written out.  */
+  struct som_content_buffer contents;
+
+  /* Set once som_prep_headers has run for an output BFD.  */
+  bool headers_prepped;
+
+  /* End of the subspace contents of an output BFD, where the symbol
+     table and what follows it are laid out from, and end of the
+     metadata in front of the contents.  */
+  unsigned long contents_end;
+  unsigned long head_end;
+
+  /* The space string table built by som_begin_writing, until
+     som_finish_writing puts it out.  */
+  char *space_strings;
+
+  /* The metadata regions while som_finish_writing is writing them.  */
+  struct som_output_image images[2];
+
+  /* Subspaces of an input BFD indexed by target_index, and sorted by
+     address, for mapping symbols to sections.  Both are NULL if they
+     were not built.  */
+  asection **subspace_by_index;
+  struct som_subspace_range *subspace_ranges;
+  unsigned int subspace_count;
+
+  /* The raw symbol dictionary while symbols are being decoded on
+     demand, and what is needed to release it.  */
+  struct som_external_symbol_dictionary_record *raw_syms;
+  void *raw_syms_map;
+  size_t raw_syms_map_size;
+
+  /* Room for every canonical symbol.  An entry has been decoded once
+     its symbol.the_bfd is set.  Becomes ROOT.symtab once all of them
+     have been.  */
+  som_symbol_type *lazy_symtab;
+
+  /* Dictionary index of each canonical symbol, or NULL if the two are
+     the same (no ST_SYM_EXT or ST_ARG_EXT records).  */
+  unsigned int *sym_dict_index;
+
+  /* Number of records in the symbol dictionary.  The symbol count of
+     the BFD drops to the number of canonical symbols once they have
+     been counted.  */
+  unsigned int sym_dict_count;
+
+  /* Name index over the canonical symbols: bucket heads (-1 for an
+     empty bucket), a power of two of them, and one chain entry per
+     symbol.  Built on the first bfd_som_lookup_symbol.  */
+  unsigned int *sym_hash_buckets;
+  struct som_symbol_hash_entry *sym_hash_chain;
+  unsigned int sym_hash_mask;
+
+  /* Function symbols sorted by section and address, built on the
+     first som_find_nearest_line since the symbol table was last
+     canonicalized.  som_canonicalize_symtab and bfd_free_cached_info
+     drop it.  */
+  struct som_func_entry *func_index;
+  unsigned int func_index_count;
+
+  /* Cached pages of an input BFD, for som_get_section_contents.  */
+  struct som_page_cache page_cache;
+
+  /* Set by bfd_som_set_optimize_fixups for an output BFD.  */
+  bool optimize_fixups;
+
+  /* Largest code subspace of an output BFD left whole by the linker,
+     set by bfd_som_set_split_size, or zero to go by the reach of
+     branches on its architecture.  */
+  bfd_size_type split_size;
+
+#ifdef SOM_STATS
+  struct som_stats stats;
+#endif
+};
+
+#define som_private_data(abfd) \
+  ((struct som_private_data *) (abfd)->tdata.som_data)
+
+/* Instrumentation, which compiles to nothing unless SOM_STATS is
+   defined.  SOM_STAT_ADD adds N to counter FIELD of ABFD.
+   SOM_STAT_TIMER_START starts timer T, and SOM_STAT_TIMER_STOP adds
+   the time since then to FIELD, tracing it to stderr if
+   SOM_TRACE_ENV is set.  Disabled, they still use ABFD, so that a
+   function using it only for them does not get an unused parameter.  */
+#define SOM_TRACE_ENV "BFD_SOM_TRACE"
+#ifdef SOM_STATS
+static void som_stat_time (bfd *, unsigned long *, long, const char *);
+#define SOM_STAT_ADD(abfd, field, n) \
+  (som_private_data (abfd)->stats.field += (n))
+#define SOM_STAT_TIMER_START(t) long t = get_run_time ()
+#define SOM_STAT_TIMER_STOP(abfd, field, t) \
+  som_stat_time (abfd, &som_private_data (abfd)->stats.field, t, #field)
+#else
+#define SOM_STAT_ADD(abfd, field, n) ((void) (abfd))
+#define SOM_STAT_TIMER_START(t) ((void) 0)
+#define SOM_STAT_TIMER_STOP(abfd, field, t) ((void) (abfd))
+#endif
+
 /* Map SOM section names to POSIX/BSD single-character symbol types.
 
    This table includes all the standard subspaces as defined in the
@@ -905,8 +1243,6 @@ static reloc_howto_type som_hppa_howto_table[] =
 static void
 som_initialize_reloc_queue (struct reloc_queue *queue)
 {
-  #define QUEUE_SIZE 4
-  
   for (int i = 0; i < QUEUE_SIZE; i++) {
     queue[i].reloc = NULL;
     queue[i].size = 0;
@@ -1002,8 +1338,6 @@ som_reloc_queue_find (unsigned char *p,
                      unsigned int size,
                      struct reloc_queue *queue)
 {
-  #define QUEUE_SIZE 4
-  
   for (int i = 0; i < QUEUE_SIZE; i++)
     {
       if (queue[i].reloc && !memcmp (p, queue[i].reloc, size)
@@ -1014,7 +1348,7 @@ som_reloc_queue_find (unsigned char *p,
 }
 
 static unsigned char *
-try_prev_fixup (bfd *abfd ATTRIBUTE_UNUSED,
+try_prev_fixup (bfd *abfd,
 		unsigned int *subspace_reloc_sizep,
 		unsigned char *p,
 		unsigned int size,
@@ -1024,6 +1358,7 @@ try_prev_fixup (bfd *abfd ATTRIBUTE_UNUSED,
 
   if (queue_index != -1)
     {
+      SOM_STAT_ADD (abfd, queue_hits, 1);
       bfd_put_8 (abfd, R_PREV_FIXUP + queue_index, p);
       p += 1;
       *subspace_reloc_sizep += 1;
@@ -1031,6 +1366,7 @@ try_prev_fixup (bfd *abfd ATTRIBUTE_UNUSED,
     }
   else
     {
+      SOM_STAT_ADD (abfd, queue_misses, 1);
       som_reloc_queue_insert (p, size, queue);
       *subspace_reloc_sizep += size;
       p += size;
@@ -1150,6 +1486,128 @@ write_aligned_skip_relocation(bfd *abfd,
     }
 }
 
+/* Have the fixup streams of SOM output BFD ABFD spend more time
+   looking for shorter encodings of the gaps between relocations if
+   OPTIMIZE, or encode them the usual way if not.  */
+
+bool
+bfd_som_set_optimize_fixups (bfd *abfd, bool optimize)
+{
+  if (bfd_get_flavour (abfd) != bfd_target_som_flavour
+      || bfd_get_format (abfd) != bfd_object)
+    {
+      bfd_set_error (bfd_error_invalid_operation);
+      return false;
+    }
+
+  som_private_data (abfd)->optimize_fixups = optimize;
+  return true;
+}
+
+/* Encode into BUF the single R_NO_RELOCATION fixup som_reloc_skip
+   would use for SKIP bytes, which must be nonzero and below
+   LARGE_SKIP_SIZE, and return its size.  */
+
+static unsigned int
+som_encode_skip (unsigned char *buf, unsigned int skip)
+{
+  #define ALIGNED_MAX 0xc0000
+  unsigned int words = (skip >> 2) - 1;
+
+  if ((skip & 3) == 0 && skip <= SINGLE_BYTE_MAX)
+    {
+      buf[0] = R_NO_RELOCATION + words;
+      return 1;
+    }
+  if ((skip & 3) == 0 && skip <= TWO_BYTE_MAX)
+    {
+      buf[0] = R_NO_RELOCATION + TWO_BYTE_OFFSET + (words >> BYTE_SHIFT);
+      buf[1] = words;
+      return 2;
+    }
+  if ((skip & 3) == 0 && skip <= ALIGNED_MAX)
+    {
+      buf[0] = R_NO_RELOCATION + THREE_BYTE_OFFSET + (words >> WORD_SHIFT);
+      bfd_putb16 (words, buf + 1);
+      return 3;
+    }
+  buf[0] = R_NO_RELOCATION + FOUR_BYTE_OFFSET;
+  buf[1] = (skip - 1) >> SKIP_SHIFT;
+  bfd_putb16 (skip - 1, buf + 2);
+  return 4;
+}
+
+/* Return the number of bytes skipped by the multibyte fixup of SIZE
+   bytes at P, or zero if it does not just skip bytes.  */
+
+static unsigned int
+som_skip_fixup_length (const unsigned char *p, unsigned int size)
+{
+  unsigned int op = p[0] - R_NO_RELOCATION;
+
+  if (size == 2 && op >= TWO_BYTE_OFFSET && op < THREE_BYTE_OFFSET)
+    return ((((op - TWO_BYTE_OFFSET) << BYTE_SHIFT) | p[1]) + 1) << 2;
+  if (size == 3 && op >= THREE_BYTE_OFFSET && op < FOUR_BYTE_OFFSET)
+    return ((((op - THREE_BYTE_OFFSET) << WORD_SHIFT) | bfd_getb16 (p + 1))
+	    + 1) << 2;
+  if (size == 4 && op == FOUR_BYTE_OFFSET)
+    return ((p[1] << SKIP_SHIFT) | bfd_getb16 (p + 2)) + 1;
+  return 0;
+}
+
+/* Return the number of bytes som_reloc_skip would take to encode SKIP
+   bytes below LARGE_SKIP_SIZE as one fixup, given QUEUE.  */
+
+static unsigned int
+som_skip_cost (unsigned int skip, struct reloc_queue *queue)
+{
+  unsigned char buf[4];
+  unsigned int size;
+
+  if (skip == 0)
+    return 0;
+  size = som_encode_skip (buf, skip);
+  if (size > 1 && som_reloc_queue_find (buf, size, queue) != -1)
+    return 1;
+  return size;
+}
+
+/* Look for a way to encode SKIP bytes below LARGE_SKIP_SIZE that is
+   shorter than the usual single fixup: repeating a skip already in
+   QUEUE with an R_PREV_FIXUP, then covering what is left.  Return the
+   queue entry to repeat, setting *PART to the bytes it skips, or -1
+   if the usual encoding is as short as any such split.  */
+
+static int
+som_plan_skip (unsigned int skip, struct reloc_queue *queue,
+	       unsigned int *part)
+{
+  unsigned int best = som_skip_cost (skip, queue);
+  int best_entry = -1;
+
+  for (int i = 0; i < QUEUE_SIZE; i++)
+    {
+      unsigned int len, cost;
+
+      if (queue[i].reloc == NULL)
+	continue;
+      len = som_skip_fixup_length (queue[i].reloc, queue[i].size);
+      if (len == 0 || len >= skip)
+	continue;
+
+      /* Repeating the entry only moves it to the front of the queue,
+	 so the rest costs the same after it as it does now.  */
+      cost = 1 + som_skip_cost (skip - len, queue);
+      if (cost < best)
+	{
+	  best = cost;
+	  best_entry = i;
+	  *part = len;
+	}
+    }
+  return best_entry;
+}
+
 static unsigned char *
 som_reloc_skip(bfd *abfd,
               unsigned int skip,
@@ -1161,6 +1619,24 @@ som_reloc_skip(bfd *abfd,
     #define ALIGNED_MAX 0xc0000
     #define ALIGNMENT_MASK 3
     
+    if (som_private_data(abfd)->optimize_fixups
+        && skip > 0 && skip < LARGE_THRESHOLD)
+    {
+        unsigned int part;
+        int entry = som_plan_skip(skip, queue, &part);
+        
+        if (entry >= 0)
+        {
+            SOM_STAT_ADD(abfd, queue_hits, 1);
+            bfd_put_8(abfd, R_PREV_FIXUP + entry, p);
+            p++;
+            *subspace_reloc_sizep += 1;
+            som_reloc_queue_fix(queue, entry);
+            return som_reloc_skip(abfd, skip - part, p, subspace_reloc_sizep,
+                                  queue);
+        }
+    }
+    
     if (skip >= LARGE_THRESHOLD)
     {
         p = write_large_skip_entries(abfd, &skip, p, subspace_reloc_sizep, queue);
@@ -2294,6 +2770,51 @@ som_object_setup (bfd *abfd,
   return _bfd_no_cleanup;
 }
 
+/* Read SIZE bytes at file position POS for temporary use.  The data is
+   mapped straight from the file when possible and read into a malloc'd
+   buffer otherwise (in-memory BFDs, files that cannot be mapped, or
+   hosts without mmap).  Either way it must be released by passing
+   *MAP_ADDR and *MAP_SIZE to _bfd_munmap_readonly_temporary.  */
+
+static void *
+som_read_temporary (bfd *abfd, file_ptr pos, size_t size,
+		    void **map_addr, size_t *map_size)
+{
+  void *data;
+
+  *map_addr = NULL;
+  *map_size = 0;
+  if (bfd_seek (abfd, pos, SEEK_SET) != 0)
+    return NULL;
+
+  data = _bfd_mmap_readonly_temporary (abfd, size, map_addr, map_size);
+  if (data == NULL)
+    {
+      *map_addr = NULL;
+      *map_size = 0;
+    }
+  return data;
+}
+
+/* Likewise, but for COUNT records of RECSIZE bytes each.  */
+
+static void *
+som_read_records_temporary (bfd *abfd, file_ptr pos, size_t count,
+			    size_t recsize, void **map_addr,
+			    size_t *map_size)
+{
+  size_t amt;
+
+  *map_addr = NULL;
+  *map_size = 0;
+  if (_bfd_mul_overflow (count, recsize, &amt))
+    {
+      bfd_set_error (bfd_error_file_too_big);
+      return NULL;
+    }
+  return som_read_temporary (abfd, pos, amt, map_addr, map_size);
+}
+
 /* Convert all of the space and subspace info into BFD sections.  Each space
    contains a number of subspaces, which in turn describe the mapping between
    regions of the exec file, and the address space that the program runs in.
@@ -2311,38 +2832,18 @@ read_space_strings(bfd *abfd, struct som_header *file_hdr, unsigned long current
     }
   if (bfd_seek (abfd, current_offset + file_hdr->space_strings_location, SEEK_SET) != 0)
     return false;
-  *space_strings = (char *) _bfd_malloc_and_read (abfd, amt + 1, amt);
+  /* Kept for the life of the BFD; section names point into it.  */
+  *space_strings = (char *) _bfd_alloc_and_read (abfd, amt + 1, amt);
   if (*space_strings == NULL)
     return false;
   (*space_strings)[amt] = 0;
   return true;
 }
 
-static bool
-read_space_dictionary(bfd *abfd, unsigned long current_offset, struct som_header *file_hdr, 
-                      unsigned int space_index, struct som_space_dictionary_record *space)
-{
-  struct som_external_space_dictionary_record ext_space;
-  if (bfd_seek (abfd, current_offset + file_hdr->space_location + 
-                space_index * sizeof (ext_space), SEEK_SET) != 0)
-    return false;
-  size_t amt = sizeof ext_space;
-  if (bfd_read (&ext_space, amt, abfd) != amt)
-    return false;
-  som_swap_space_dictionary_in (&ext_space, space);
-  return true;
-}
-
 static asection *
 create_space_section(bfd *abfd, char *space_name, struct som_space_dictionary_record *space)
 {
-  size_t amt = strlen (space_name) + 1;
-  char *newname = bfd_alloc (abfd, amt);
-  if (!newname)
-    return NULL;
-  strcpy (newname, space_name);
-  
-  asection *space_asect = bfd_make_section_anyway (abfd, newname);
+  asection *space_asect = bfd_make_section_anyway (abfd, space_name);
   if (!space_asect)
     return NULL;
   
@@ -2357,25 +2858,6 @@ create_space_section(bfd *abfd, char *space_name, struct som_space_dictionary_re
   return space_asect;
 }
 
-static bool
-read_first_subspace(bfd *abfd, unsigned long current_offset, struct som_header *file_hdr,
-                   struct som_space_dictionary_record *space, 
-                   struct som_subspace_dictionary_record *subspace)
-{
-  struct som_external_subspace_dictionary_record ext_subspace;
-  if (bfd_seek (abfd, current_offset + file_hdr->subspace_location + 
-                space->subspace_index * sizeof ext_subspace, SEEK_SET) != 0)
-    return false;
-  size_t amt = sizeof ext_subspace;
-  if (bfd_read (&ext_subspace, amt, abfd) != amt)
-    return false;
-  if (bfd_seek (abfd, current_offset + file_hdr->subspace_location + 
-                space->subspace_index * sizeof ext_subspace, SEEK_SET) != 0)
-    return false;
-  som_swap_subspace_dictionary_in (&ext_subspace, subspace);
-  return true;
-}
-
 static void
 init_space_section_from_subspace(asection *space_asect, 
                                  struct som_subspace_dictionary_record *subspace,
@@ -2440,13 +2922,7 @@ create_subspace_section(bfd *abfd, char *subspace_name, asection *space_asect,
                        struct som_subspace_dictionary_record *subspace,
                        unsigned long current_offset)
 {
-  size_t amt = strlen (subspace_name) + 1;
-  char *newname = bfd_alloc (abfd, amt);
-  if (!newname)
-    return NULL;
-  strcpy (newname, subspace_name);
-  
-  asection *subspace_asect = bfd_make_section_anyway (abfd, newname);
+  asection *subspace_asect = bfd_make_section_anyway (abfd, subspace_name);
   if (!subspace_asect)
     return NULL;
   
@@ -2472,9 +2948,10 @@ create_subspace_section(bfd *abfd, char *subspace_name, asection *space_asect,
 static bool
 process_subspaces(bfd *abfd, struct som_header *file_hdr, unsigned long current_offset,
                  struct som_space_dictionary_record *space, asection *space_asect,
-                 char *space_strings, unsigned int *total_subspaces)
+                 char *space_strings,
+                 struct som_external_subspace_dictionary_record *ext_subspaces,
+                 unsigned int *total_subspaces)
 {
-  struct som_external_subspace_dictionary_record ext_subspace;
   struct som_subspace_dictionary_record subspace, save_subspace;
   bfd_size_type space_size = 0;
   
@@ -2482,11 +2959,9 @@ process_subspaces(bfd *abfd, struct som_header *file_hdr, unsigned long current_
   
   for (unsigned int subspace_index = 0; subspace_index < space->subspace_quantity; subspace_index++)
     {
-      size_t amt = sizeof ext_subspace;
-      if (bfd_read (&ext_subspace, amt, abfd) != amt)
-        return false;
-      
-      som_swap_subspace_dictionary_in (&ext_subspace, &subspace);
+      unsigned int dict_index = space->subspace_index + subspace_index;
+
+      som_swap_subspace_dictionary_in (&ext_subspaces[dict_index], &subspace);
       
       if (subspace.name >= file_hdr->space_strings_size)
         return false;
@@ -2499,7 +2974,8 @@ process_subspaces(bfd *abfd, struct som_header *file_hdr, unsigned long current_
         return false;
       
       (*total_subspaces)++;
-      subspace_asect->target_index = bfd_tell (abfd) - sizeof (subspace);
+      /* Only used as a sort key by assign_subspace_indices.  */
+      subspace_asect->target_index = dict_index;
       
       if (subspace_asect->alignment_power == (unsigned) -1)
         return false;
@@ -2530,16 +3006,31 @@ assign_subspace_indices(bfd *abfd, unsigned int total_subspaces)
       return false;
     }
   
-  asection **subspace_sections = bfd_malloc (amt);
+  /* Both tables are kept for bfd_section_from_som_symbol.  */
+  asection **subspace_sections = bfd_alloc (abfd, amt);
   if (subspace_sections == NULL)
     return false;
   
+  if (_bfd_mul_overflow (total_subspaces, sizeof (struct som_subspace_range),
+			 &amt))
+    {
+      bfd_set_error (bfd_error_file_too_big);
+      return false;
+    }
+  struct som_subspace_range *ranges = bfd_alloc (abfd, amt);
+  if (ranges == NULL)
+    return false;
+  
   unsigned int i = 0;
   for (asection *section = abfd->sections; section; section = section->next)
     {
       if (!som_is_subspace (section))
         continue;
       subspace_sections[i] = section;
+      ranges[i].vma = section->vma;
+      ranges[i].end = section->vma + section->size;
+      ranges[i].list_pos = i;
+      ranges[i].section = section;
       i++;
     }
   
@@ -2548,7 +3039,18 @@ assign_subspace_indices(bfd *abfd, unsigned int total_subspaces)
   for (i = 0; i < total_subspaces; i++)
     subspace_sections[i]->target_index = i;
   
-  free (subspace_sections);
+  qsort (ranges, total_subspaces, sizeof (*ranges), compare_subspace_ranges);
+  
+  for (i = 0; i < total_subspaces; i++)
+    {
+      ranges[i].max_end = ranges[i].end;
+      if (i != 0 && ranges[i - 1].max_end > ranges[i].max_end)
+        ranges[i].max_end = ranges[i - 1].max_end;
+    }
+  
+  som_private_data (abfd)->subspace_by_index = subspace_sections;
+  som_private_data (abfd)->subspace_ranges = ranges;
+  som_private_data (abfd)->subspace_count = total_subspaces;
   return true;
 }
 
@@ -2557,17 +3059,42 @@ setup_sections (bfd *abfd, struct som_header *file_hdr, unsigned long current_of
 {
   char *space_strings = NULL;
   unsigned int total_subspaces = 0;
+  struct som_external_space_dictionary_record *ext_spaces = NULL;
+  struct som_external_subspace_dictionary_record *ext_subspaces = NULL;
+  void *spaces_map = NULL, *subspaces_map = NULL;
+  size_t spaces_map_size = 0, subspaces_map_size = 0;
+  bool ok = false;
   
   if (!read_space_strings(abfd, file_hdr, current_offset, &space_strings))
     goto error_return;
+
+  /* Pull in both dictionaries with one read (or mapping) each rather
+     than seeking to every record.  */
+  if (file_hdr->space_total != 0)
+    {
+      ext_spaces = som_read_records_temporary
+	(abfd, current_offset + file_hdr->space_location,
+	 file_hdr->space_total, sizeof (*ext_spaces),
+	 &spaces_map, &spaces_map_size);
+      if (ext_spaces == NULL)
+	goto error_return;
+    }
+  if (file_hdr->subspace_total != 0)
+    {
+      ext_subspaces = som_read_records_temporary
+	(abfd, current_offset + file_hdr->subspace_location,
+	 file_hdr->subspace_total, sizeof (*ext_subspaces),
+	 &subspaces_map, &subspaces_map_size);
+      if (ext_subspaces == NULL)
+	goto error_return;
+    }
   
   for (unsigned int space_index = 0; space_index < file_hdr->space_total; space_index++)
     {
       struct som_space_dictionary_record space;
       struct som_subspace_dictionary_record subspace;
       
-      if (!read_space_dictionary(abfd, current_offset, file_hdr, space_index, &space))
-        goto error_return;
+      som_swap_space_dictionary_in (&ext_spaces[space_index], &space);
       
       if (space.name >= file_hdr->space_strings_size)
         goto error_return;
@@ -2579,28 +3106,33 @@ setup_sections (bfd *abfd, struct som_header *file_hdr, unsigned long current_of
       
       if (space.subspace_quantity == 0)
         continue;
+
+      if (space.subspace_index >= file_hdr->subspace_total
+	  || (space.subspace_quantity
+	      > file_hdr->subspace_total - space.subspace_index))
+	goto error_return;
       
-      if (!read_first_subspace(abfd, current_offset, file_hdr, &space, &subspace))
-        goto error_return;
+      som_swap_subspace_dictionary_in (&ext_subspaces[space.subspace_index],
+				       &subspace);
       
       init_space_section_from_subspace(space_asect, &subspace, current_offset);
       if (space_asect->alignment_power == (unsigned) -1)
         goto error_return;
       
       if (!process_subspaces(abfd, file_hdr, current_offset, &space, space_asect,
-                            space_strings, &total_subspaces))
+                            space_strings, ext_subspaces, &total_subspaces))
         goto error_return;
     }
   
   if (!assign_subspace_indices(abfd, total_subspaces))
     goto error_return;
   
-  free (space_strings);
-  return true;
+  ok = true;
   
  error_return:
-  free (space_strings);
-  return false;
+  _bfd_munmap_readonly_temporary (spaces_map, spaces_map_size);
+  _bfd_munmap_readonly_temporary (subspaces_map, subspaces_map_size);
+  return ok;
 }
 
 
@@ -2761,8 +3293,11 @@ som_object_p(bfd *abfd)
 static bool
 som_mkobject (bfd *abfd)
 {
-  abfd->tdata.som_data = bfd_zalloc (abfd, (bfd_size_type) sizeof (struct som_data_struct));
-  return abfd->tdata.som_data != NULL;
+  abfd->tdata.som_data = bfd_zalloc (abfd, (bfd_size_type) sizeof (struct som_private_data));
+  if (abfd->tdata.som_data == NULL)
+    return false;
+  som_private_data (abfd)->page_cache.budget = SOM_PAGE_CACHE_BUDGET;
+  return true;
 }
 
 /* Initialize some information in the file header.  This routine makes
@@ -2815,11 +3350,13 @@ initialize_file_header_fields(struct som_header *file_hdr)
 }
 
 static bool
-allocate_space_dictionary(bfd *abfd, asection *section)
+allocate_space_dictionary(bfd *abfd ATTRIBUTE_UNUSED, asection *section)
 {
-  size_t amt = sizeof(struct som_space_dictionary_record);
-  som_section_data(section)->space_dict = bfd_zalloc(abfd, amt);
-  return som_section_data(section)->space_dict != NULL;
+  struct som_private_section_data *sdata = som_private_section_data(section);
+
+  memset(&sdata->dict.space, 0, sizeof(sdata->dict.space));
+  sdata->root.space_dict = &sdata->dict.space;
+  return true;
 }
 
 static void
@@ -2837,11 +3374,13 @@ set_space_attributes(asection *section)
 }
 
 static bool
-allocate_subspace_dictionary(bfd *abfd, asection *section)
+allocate_subspace_dictionary(bfd *abfd ATTRIBUTE_UNUSED, asection *section)
 {
-  size_t amt = sizeof(struct som_subspace_dictionary_record);
-  som_section_data(section)->subspace_dict = bfd_zalloc(abfd, amt);
-  return som_section_data(section)->subspace_dict != NULL;
+  struct som_private_section_data *sdata = som_private_section_data(section);
+
+  memset(&sdata->dict.subspace, 0, sizeof(sdata->dict.subspace));
+  sdata->root.subspace_dict = &sdata->dict.subspace;
+  return true;
 }
 
 static void
@@ -2918,11 +3457,152 @@ process_sections(bfd *abfd)
   return true;
 }
 
+/* Order space sections by address, for find_space_group.  */
+
+static int
+compare_space_groups (const void *arg1, const void *arg2)
+{
+  const struct som_space_group *g1 = *(const struct som_space_group **) arg1;
+  const struct som_space_group *g2 = *(const struct som_space_group **) arg2;
+
+  if (g1->space != g2->space)
+    return (uintptr_t) g1->space < (uintptr_t) g2->space ? -1 : 1;
+  return 0;
+}
+
+/* Return the group in BY_SPACE, an array of COUNT groups sorted by
+   compare_space_groups, whose space is SPACE, or NULL.  */
+
+static struct som_space_group *
+find_space_group (struct som_space_group **by_space, unsigned int count,
+		  asection *space)
+{
+  unsigned int lo = 0, hi = count;
+
+  while (lo < hi)
+    {
+      unsigned int mid = lo + (hi - lo) / 2;
+
+      if (by_space[mid]->space == space)
+	return by_space[mid];
+      if ((uintptr_t) by_space[mid]->space < (uintptr_t) space)
+	lo = mid + 1;
+      else
+	hi = mid;
+    }
+  return NULL;
+}
+
+/* Group the subspaces of ABFD by the space containing them, keeping
+   both spaces and subspaces in section list order.  This is the order
+   the writers emit them in.  */
+
+static bool
+build_space_groups (bfd *abfd)
+{
+  struct som_private_data *sdata = som_private_data (abfd);
+  struct som_space_group *groups, **by_space;
+  struct som_space_group **owner = NULL;
+  asection **subspaces;
+  unsigned int num_spaces = 0, num_subspaces = 0, i;
+  asection *section;
+  size_t amt;
+  bool ok = false;
+
+  for (section = abfd->sections; section != NULL; section = section->next)
+    {
+      if (som_is_space (section))
+	num_spaces++;
+      else if (som_is_subspace (section))
+	num_subspaces++;
+    }
+
+  if (_bfd_mul_overflow (num_spaces, sizeof (*groups), &amt))
+    {
+      bfd_set_error (bfd_error_file_too_big);
+      return false;
+    }
+  groups = bfd_zalloc (abfd, amt);
+  if (groups == NULL && amt != 0)
+    return false;
+  if (_bfd_mul_overflow (num_subspaces, sizeof (*subspaces), &amt))
+    {
+      bfd_set_error (bfd_error_file_too_big);
+      return false;
+    }
+  subspaces = bfd_alloc (abfd, amt);
+  if (subspaces == NULL && amt != 0)
+    return false;
+
+  by_space = bfd_malloc (num_spaces * sizeof (*by_space) + 1);
+  owner = bfd_malloc (num_subspaces * sizeof (*owner) + 1);
+  if (by_space == NULL || owner == NULL)
+    goto out;
+
+  i = 0;
+  for (section = abfd->sections; section != NULL; section = section->next)
+    if (som_is_space (section))
+      {
+	groups[i].space = section;
+	by_space[i] = &groups[i];
+	i++;
+      }
+  qsort (by_space, num_spaces, sizeof (*by_space), compare_space_groups);
+
+  /* Count the subspaces of each space, then hand out slots.  */
+  i = 0;
+  for (section = abfd->sections; section != NULL; section = section->next)
+    {
+      struct som_copyable_section_data_struct *copy_data;
+
+      if (!som_is_subspace (section))
+	continue;
+
+      copy_data = som_section_data (section)->copy_data;
+      owner[i] = find_space_group (by_space, num_spaces, copy_data->container);
+      if (owner[i] == NULL && copy_data->container->output_section != NULL)
+	owner[i] = find_space_group (by_space, num_spaces,
+				     copy_data->container->output_section);
+      if (owner[i] != NULL)
+	owner[i]->count++;
+      i++;
+    }
+
+  amt = 0;
+  for (i = 0; i < num_spaces; i++)
+    {
+      groups[i].subspaces = subspaces + amt;
+      amt += groups[i].count;
+      groups[i].count = 0;
+    }
+
+  i = 0;
+  for (section = abfd->sections; section != NULL; section = section->next)
+    if (som_is_subspace (section))
+      {
+	if (owner[i] != NULL)
+	  owner[i]->subspaces[owner[i]->count++] = section;
+	i++;
+      }
+
+  sdata->space_groups = groups;
+  sdata->space_group_count = num_spaces;
+  ok = true;
+
+ out:
+  free (by_space);
+  free (owner);
+  return ok;
+}
+
 static bool
 som_prep_headers(bfd *abfd)
 {
   struct som_header *file_hdr;
   
+  if (som_private_data(abfd)->headers_prepped)
+    return true;
+  
   if (!allocate_file_header(abfd))
     return false;
   
@@ -2941,7 +3621,14 @@ som_prep_headers(bfd *abfd)
   
   initialize_file_header_fields(file_hdr);
   
-  return process_sections(abfd);
+  if (!process_sections(abfd))
+    return false;
+  
+  if (!build_space_groups(abfd))
+    return false;
+  
+  som_private_data(abfd)->headers_prepped = true;
+  return true;
 }
 
 /* Return TRUE if the given section is a SOM space, FALSE otherwise.  */
@@ -2982,17 +3669,6 @@ som_is_subspace (asection *section)
   return true;
 }
 
-/* Return TRUE if the given space contains the given subspace.  It
-   is safe to assume space really is a space, and subspace really
-   is a subspace.  */
-
-static bool
-som_is_container (asection *space, asection *subspace)
-{
-  asection *container = som_section_data (subspace)->copy_data->container;
-  return (container == space) || (container->output_section == space);
-}
-
 /* Count and return the number of spaces attached to the given BFD.  */
 
 static unsigned long
@@ -3021,11 +3697,15 @@ som_count_subspaces (bfd *abfd)
   return count;
 }
 
-/* Return -1, 0, 1 indicating the relative ordering of sym1 and sym2.
+/* The sort key for a symbol when ordering symbols for the fixup
+   stream.  Sorting these rather than the asymbol pointers keeps the
+   comparisons from chasing every symbol.  */
 
-   We desire symbols to be ordered starting with the symbol with the
-   highest relocation count down to the symbol with the lowest relocation
-   count.  Doing so compacts the relocation stream.  */
+struct som_sym_sort_key
+{
+  unsigned int count;
+  unsigned int pos;
+};
 
 static unsigned int get_relocation_count(asymbol *sym)
 {
@@ -3034,18 +3714,95 @@ static unsigned int get_relocation_count(asymbol *sym)
   return som_symbol_data(sym)->reloc_count;
 }
 
+/* Return -1, 0, 1 indicating the relative ordering of two
+   som_sym_sort_keys.
+
+   We desire symbols to be ordered starting with the symbol with the
+   highest relocation count down to the symbol with the lowest relocation
+   count.  Doing so compacts the relocation stream.  Symbols with the
+   same count keep their original order.  */
+
 static int
 compare_syms (const void *arg1, const void *arg2)
 {
-  asymbol **sym1 = (asymbol **) arg1;
-  asymbol **sym2 = (asymbol **) arg2;
-  unsigned int count1 = get_relocation_count(*sym1);
-  unsigned int count2 = get_relocation_count(*sym2);
+  const struct som_sym_sort_key *key1 = arg1;
+  const struct som_sym_sort_key *key2 = arg2;
+  unsigned int count1 = key1->count;
+  unsigned int count2 = key2->count;
 
   if (count1 < count2)
     return 1;
   if (count1 > count2)
     return -1;
+  if (key1->pos != key2->pos)
+    return key1->pos < key2->pos ? -1 : 1;
+  return 0;
+}
+
+/* Only the first 0x100 symbol indices can use the one and two byte
+   R_*_ONE_SYMBOL forms; past that every index costs the same.  */
+
+#define SOM_SHORT_SYM_INDEX_LIMIT 0x100
+
+/* Rearrange the NUM entries of KEYS such that the first K of them are
+   the K lowest according to compare_syms, in no particular order.  */
+
+static void
+select_sym_sort_keys (struct som_sym_sort_key *keys, size_t num, size_t k)
+{
+  size_t lo = 0, hi = num;
+  struct som_sym_sort_key tmp;
+
+  while (hi - lo > 1)
+    {
+      size_t mid = lo + (hi - lo) / 2;
+      size_t i, store;
+
+      /* Median of three, left at hi - 1 as the pivot.  */
+      if (compare_syms (&keys[mid], &keys[lo]) < 0)
+	{
+	  tmp = keys[mid]; keys[mid] = keys[lo]; keys[lo] = tmp;
+	}
+      if (compare_syms (&keys[hi - 1], &keys[lo]) < 0)
+	{
+	  tmp = keys[hi - 1]; keys[hi - 1] = keys[lo]; keys[lo] = tmp;
+	}
+      if (compare_syms (&keys[mid], &keys[hi - 1]) < 0)
+	{
+	  tmp = keys[mid]; keys[mid] = keys[hi - 1]; keys[hi - 1] = tmp;
+	}
+
+      store = lo;
+      for (i = lo; i < hi - 1; i++)
+	if (compare_syms (&keys[i], &keys[hi - 1]) < 0)
+	  {
+	    tmp = keys[i]; keys[i] = keys[store]; keys[store] = tmp;
+	    store++;
+	  }
+      tmp = keys[store]; keys[store] = keys[hi - 1]; keys[hi - 1] = tmp;
+
+      if (store == k)
+	return;
+      if (store < k)
+	lo = store + 1;
+      else
+	hi = store;
+    }
+}
+
+/* Order som_subspace_range entries by address, then by position in
+   the section list.  */
+
+static int
+compare_subspace_ranges (const void *arg1, const void *arg2)
+{
+  const struct som_subspace_range *r1 = arg1;
+  const struct som_subspace_range *r2 = arg2;
+
+  if (r1->vma != r2->vma)
+    return r1->vma < r2->vma ? -1 : 1;
+  if (r1->list_pos != r2->list_pos)
+    return r1->list_pos < r2->list_pos ? -1 : 1;
   return 0;
 }
 
@@ -3070,9 +3827,9 @@ compare_subspaces (const void *arg1, const void *arg2)
 static bool
 som_prep_for_fixups (bfd *abfd, asymbol **syms, unsigned long num_syms)
 {
-  unsigned long i;
-  asection *section;
+  unsigned long i, j, nshort;
   asymbol **sorted_syms;
+  struct som_sym_sort_key *keys;
   size_t amt;
 
   if (num_syms == 0)
@@ -3089,8 +3846,52 @@ som_prep_for_fixups (bfd *abfd, asymbol **syms, unsigned long num_syms)
   sorted_syms = bfd_zalloc (abfd, amt);
   if (sorted_syms == NULL)
     return false;
-  memcpy (sorted_syms, syms, num_syms * sizeof (asymbol *));
-  qsort (sorted_syms, num_syms, sizeof (asymbol *), compare_syms);
+
+  if ((unsigned int) num_syms != num_syms
+      || _bfd_mul_overflow (num_syms, sizeof (*keys), &amt))
+    {
+      bfd_set_error (bfd_error_no_memory);
+      return false;
+    }
+  keys = bfd_malloc (amt);
+  if (keys == NULL)
+    return false;
+  for (i = 0; i < num_syms; i++)
+    {
+      keys[i].count = get_relocation_count (syms[i]);
+      keys[i].pos = i;
+    }
+
+  /* Only the symbols which land in the short index range benefit from
+     being ordered by count.  Select those, sort just them, and leave
+     everyone else in their original order after them.  */
+  nshort = num_syms;
+  if (nshort > SOM_SHORT_SYM_INDEX_LIMIT)
+    {
+      nshort = SOM_SHORT_SYM_INDEX_LIMIT;
+      select_sym_sort_keys (keys, num_syms, nshort);
+    }
+  qsort (keys, nshort, sizeof (*keys), compare_syms);
+  for (i = 0; i < nshort; i++)
+    sorted_syms[i] = syms[keys[i].pos];
+
+  if (nshort < num_syms)
+    {
+      unsigned char *placed = bfd_zmalloc (num_syms);
+
+      if (placed == NULL)
+	{
+	  free (keys);
+	  return false;
+	}
+      for (i = 0; i < nshort; i++)
+	placed[keys[i].pos] = 1;
+      for (i = 0, j = nshort; i < num_syms; i++)
+	if (!placed[i])
+	  sorted_syms[j++] = syms[i];
+      free (placed);
+    }
+  free (keys);
   obj_som_sorted_syms (abfd) = sorted_syms;
 
   assign_symbol_indexes(sorted_syms, num_syms);
@@ -3198,11 +3999,13 @@ assign_symbol_indexes(asymbol **sorted_syms, unsigned long num_syms)
 #define COMP1_CONSTANT 0x44
 #define RESERVED_RELOC 0xff
 
+/* Check BFD_RELOC against the end of the previous relocation in the
+   subspace, RELOC_OFFSET, and against the bounds of SUBSECTION.  */
+
 static bool
-validate_relocation(bfd *abfd, asection *subsection, arelent *bfd_reloc)
+validate_relocation(bfd *abfd, asection *subsection, arelent *bfd_reloc,
+                    unsigned int reloc_offset)
 {
-    static unsigned int reloc_offset = 0;
-    
     if (bfd_reloc->address < reloc_offset)
     {
         _bfd_error_handler
@@ -3227,7 +4030,6 @@ validate_relocation(bfd *abfd, asection *subsection, arelent *bfd_reloc)
         return false;
     }
     
-    reloc_offset = bfd_reloc->address + bfd_reloc->howto->size;
     return true;
 }
 
@@ -3239,17 +4041,48 @@ get_symbol_number(arelent *bfd_reloc)
     return som_symbol_data(*bfd_reloc->sym_ptr_ptr)->index;
 }
 
+/* Make sure there is room for at least SOM_TMP_BUFSIZE_THRESHOLD more
+   bytes of fixups after P in *BUFP, a malloc'd buffer of *BUF_SIZEP
+   bytes, growing it if need be.  Entries in RELOC_QUEUE and *MARKP
+   point into the buffer and are moved along with it.
+
+   The fixup stream used to be flushed to disk whenever a subspace's
+   pending fixups filled a SOM_TMP_BUFSIZE buffer, starting a fresh
+   queue each time.  *MARKP is where that last happened; the queue is
+   still reset at the same points so that the output does not change.  */
+
 static unsigned char *
-flush_buffer_if_needed(bfd *abfd, unsigned char *p, unsigned char *tmp_space,
-                       void *reloc_queue)
+grow_fixup_buffer_if_needed(unsigned char *p, unsigned char **bufp,
+                            size_t *buf_sizep, unsigned char **markp,
+                            struct reloc_queue *reloc_queue)
 {
-    if (p - tmp_space + SOM_TMP_BUFSIZE_THRESHOLD > SOM_TMP_BUFSIZE)
+    if (p - *markp + SOM_TMP_BUFSIZE_THRESHOLD > SOM_TMP_BUFSIZE)
     {
-        size_t amt = p - tmp_space;
-        if (bfd_write(tmp_space, amt, abfd) != amt)
-            return NULL;
         som_initialize_reloc_queue(reloc_queue);
-        return tmp_space;
+        *markp = p;
+    }
+    
+    if (p - *bufp + SOM_TMP_BUFSIZE_THRESHOLD > *buf_sizep)
+    {
+        size_t new_size = *buf_sizep * 2;
+        unsigned char *new_buf;
+        
+        if (new_size < *buf_sizep)
+        {
+            bfd_set_error(bfd_error_file_too_big);
+            return NULL;
+        }
+        new_buf = bfd_realloc(*bufp, new_size);
+        if (new_buf == NULL)
+            return NULL;
+        
+        for (int i = 0; i < QUEUE_SIZE; i++)
+            if (reloc_queue[i].reloc != NULL)
+                reloc_queue[i].reloc = new_buf + (reloc_queue[i].reloc - *bufp);
+        p = new_buf + (p - *bufp);
+        *markp = new_buf + (*markp - *bufp);
+        *bufp = new_buf;
+        *buf_sizep = new_size;
     }
     return p;
 }
@@ -3265,7 +4098,7 @@ write_symbol_reloc_small(bfd *abfd, unsigned char *p, unsigned int *subspace_rel
 
 static unsigned char *
 write_symbol_reloc_medium(bfd *abfd, unsigned char *p, unsigned int *subspace_reloc_size,
-                          int howto_type, int sym_num, void *reloc_queue)
+                          int howto_type, int sym_num, struct reloc_queue *reloc_queue)
 {
     bfd_put_8(abfd, howto_type + 32, p);
     bfd_put_8(abfd, sym_num, p + 1);
@@ -3274,7 +4107,7 @@ write_symbol_reloc_medium(bfd *abfd, unsigned char *p, unsigned int *subspace_re
 
 static unsigned char *
 write_symbol_reloc_large(bfd *abfd, unsigned char *p, unsigned int *subspace_reloc_size,
-                         int howto_type, int sym_num, void *reloc_queue)
+                         int howto_type, int sym_num, struct reloc_queue *reloc_queue)
 {
     bfd_put_8(abfd, howto_type + 33, p);
     bfd_put_8(abfd, sym_num >> 16, p + 1);
@@ -3284,7 +4117,7 @@ write_symbol_reloc_large(bfd *abfd, unsigned char *p, unsigned int *subspace_rel
 
 static unsigned char *
 process_code_or_dp_reloc(bfd *abfd, unsigned char *p, unsigned int *subspace_reloc_size,
-                         arelent *bfd_reloc, int sym_num, void *reloc_queue)
+                         arelent *bfd_reloc, int sym_num, struct reloc_queue *reloc_queue)
 {
     if (bfd_reloc->addend)
         p = som_reloc_addend(abfd, bfd_reloc->addend, p, subspace_reloc_size, reloc_queue);
@@ -3301,7 +4134,7 @@ process_code_or_dp_reloc(bfd *abfd, unsigned char *p, unsigned int *subspace_rel
 
 static unsigned char *
 process_data_gprel(bfd *abfd, unsigned char *p, unsigned int *subspace_reloc_size,
-                  arelent *bfd_reloc, int sym_num, void *reloc_queue)
+                  arelent *bfd_reloc, int sym_num, struct reloc_queue *reloc_queue)
 {
     if (bfd_reloc->addend)
         p = som_reloc_addend(abfd, bfd_reloc->addend, p, subspace_reloc_size, reloc_queue);
@@ -3319,7 +4152,7 @@ process_data_gprel(bfd *abfd, unsigned char *p, unsigned int *subspace_reloc_siz
 
 static unsigned char *
 process_data_symbol_reloc(bfd *abfd, unsigned char *p, unsigned int *subspace_reloc_size,
-                         arelent *bfd_reloc, int sym_num, void *reloc_queue)
+                         arelent *bfd_reloc, int sym_num, struct reloc_queue *reloc_queue)
 {
     if (bfd_reloc->howto->type != R_DATA_ONE_SYMBOL && bfd_reloc->addend)
         p = som_reloc_addend(abfd, bfd_reloc->addend, p, subspace_reloc_size, reloc_queue);
@@ -3356,7 +4189,7 @@ find_next_exit_reloc(asection *subsection, unsigned int start_idx)
 
 static unsigned char *
 process_entry_reloc(bfd *abfd, unsigned char *p, unsigned int *subspace_reloc_size,
-                   arelent *bfd_reloc, asection *subsection, unsigned int j, void *reloc_queue)
+                   arelent *bfd_reloc, asection *subsection, unsigned int j, struct reloc_queue *reloc_queue)
 {
     bfd_put_8(abfd, R_ENTRY, p);
     bfd_put_32(abfd, bfd_reloc->addend, p + 1);
@@ -3392,7 +4225,7 @@ process_simple_reloc(bfd *abfd, unsigned char *p, unsigned int *subspace_reloc_s
 
 static unsigned char *
 process_end_try_reloc(bfd *abfd, unsigned char *p, unsigned int *subspace_reloc_size,
-                     arelent *bfd_reloc, void *reloc_queue)
+                     arelent *bfd_reloc, struct reloc_queue *reloc_queue)
 {
     if (bfd_reloc->addend == 0)
     {
@@ -3416,7 +4249,7 @@ process_end_try_reloc(bfd *abfd, unsigned char *p, unsigned int *subspace_reloc_
 
 static unsigned char *
 process_comp1_reloc(bfd *abfd, unsigned char *p, unsigned int *subspace_reloc_size,
-                   arelent *bfd_reloc, void *reloc_queue)
+                   arelent *bfd_reloc, struct reloc_queue *reloc_queue)
 {
     bfd_put_8(abfd, bfd_reloc->howto->type, p);
     bfd_put_8(abfd, COMP1_CONSTANT, p + 1);
@@ -3425,7 +4258,7 @@ process_comp1_reloc(bfd *abfd, unsigned char *p, unsigned int *subspace_reloc_si
 
 static unsigned char *
 process_comp2_reloc(bfd *abfd, unsigned char *p, unsigned int *subspace_reloc_size,
-                   arelent *bfd_reloc, int sym_num, void *reloc_queue)
+                   arelent *bfd_reloc, int sym_num, struct reloc_queue *reloc_queue)
 {
     bfd_put_8(abfd, bfd_reloc->howto->type, p);
     bfd_put_8(abfd, COMP2_CONSTANT, p + 1);
@@ -3437,7 +4270,7 @@ process_comp2_reloc(bfd *abfd, unsigned char *p, unsigned int *subspace_reloc_si
 static unsigned char *
 process_single_relocation(bfd *abfd, unsigned char *p, unsigned int *subspace_reloc_size,
                          arelent *bfd_reloc, asection *subsection, unsigned int j,
-                         unsigned int *current_rounding_mode, void *reloc_queue
+                         unsigned int *current_rounding_mode, struct reloc_queue *reloc_queue
 #ifndef NO_PCREL_MODES
                          , unsigned int *current_call_mode
 #endif
@@ -3511,23 +4344,46 @@ process_single_relocation(bfd *abfd, unsigned char *p, unsigned int *subspace_re
     }
 }
 
+/* The encoded fixup stream of one subspace.  */
+
+struct som_fixup_stream
+{
+  asection *subspace;
+  unsigned char *buf;
+  unsigned int size;
+};
+
+/* Encode the fixups for SUBSECTION into a buffer of its own, recorded
+   in STREAM.  This only reads shared state, so the streams of different
+   subspaces do not depend on each other; their position in the fixup
+   area is worked out afterwards by som_encode_fixups.  */
+
 static bool
-process_subspace_relocations(bfd *abfd, asection *subsection, unsigned char *tmp_space,
-                            unsigned int current_offset, unsigned int *total_reloc_size)
+process_subspace_relocations(bfd *abfd, asection *subsection,
+                            struct som_fixup_stream *stream)
 {
-    unsigned char *p = tmp_space;
+    size_t buf_size;
+    unsigned char *buf;
+    unsigned char *p;
+    unsigned char *mark;
     unsigned int subspace_reloc_size = 0;
     unsigned int reloc_offset = 0;
     unsigned int current_rounding_mode = R_N_MODE;
 #ifndef NO_PCREL_MODES
     unsigned int current_call_mode = R_SHORT_PCREL_MODE;
 #endif
-    void *reloc_queue;
-    
-    som_section_data(subsection)->subspace_dict->fixup_request_index = *total_reloc_size;
+    struct reloc_queue reloc_queue[QUEUE_SIZE];
     
-    if (bfd_seek(abfd, current_offset + *total_reloc_size, SEEK_SET) != 0)
+    /* Most fixups take a few bytes; start from a guess based on that.  */
+    buf_size = 2 * SOM_TMP_BUFSIZE_THRESHOLD;
+    if (subsection->reloc_count < SOM_TMP_BUFSIZE)
+        buf_size += subsection->reloc_count * 4;
+    else
+        buf_size = SOM_TMP_BUFSIZE * 4;
+    buf = bfd_malloc(buf_size);
+    if (buf == NULL)
         return false;
+    p = mark = buf;
     
     som_initialize_reloc_queue(reloc_queue);
     
@@ -3535,17 +4391,18 @@ process_subspace_relocations(bfd *abfd, asection *subsection, unsigned char *tmp
     {
         arelent *bfd_reloc = subsection->orelocation[j];
         
-        if (!validate_relocation(abfd, subsection, bfd_reloc))
-            return false;
+        if (!validate_relocation(abfd, subsection, bfd_reloc, reloc_offset))
+            goto error_return;
         
-        p = flush_buffer_if_needed(abfd, p, tmp_space, reloc_queue);
+        p = grow_fixup_buffer_if_needed(p, &buf, &buf_size, &mark, reloc_queue);
         if (!p)
-            return false;
+            goto error_return;
         
         unsigned int skip = bfd_reloc->address - reloc_offset;
         p = som_reloc_skip(abfd, skip, p, &subspace_reloc_size, reloc_queue);
         
         reloc_offset = bfd_reloc->address + bfd_reloc->howto->size;
+        SOM_STAT_ADD(abfd, fixups_encoded[bfd_reloc->howto->type & 0xff], 1);
         
         p = process_single_relocation(abfd, p, &subspace_reloc_size, bfd_reloc,
                                      subsection, j, &current_rounding_mode, reloc_queue
@@ -3555,24 +4412,26 @@ process_subspace_relocations(bfd *abfd, asection *subsection, unsigned char *tmp
                                      );
     }
     
+    p = grow_fixup_buffer_if_needed(p, &buf, &buf_size, &mark, reloc_queue);
+    if (!p)
+        goto error_return;
     p = som_reloc_skip(abfd, subsection->size - reloc_offset, p, &subspace_reloc_size, reloc_queue);
     
-    size_t amt = p - tmp_space;
-    if (bfd_write(tmp_space, amt, abfd) != amt)
-        return false;
-    
-    *total_reloc_size += subspace_reloc_size;
+    stream->subspace = subsection;
+    stream->buf = buf;
+    stream->size = subspace_reloc_size;
     som_section_data(subsection)->subspace_dict->fixup_request_quantity = subspace_reloc_size;
     
     return true;
+    
+ error_return:
+    free(buf);
+    return false;
 }
 
 static bool
-should_process_subspace(asection *subsection, asection *section)
+should_process_subspace(asection *subsection)
 {
-    if (!som_is_subspace(subsection) || !som_is_container(section, subsection))
-        return false;
-    
     if ((subsection->flags & SEC_HAS_CONTENTS) == 0)
     {
         som_section_data(subsection)->subspace_dict->fixup_request_index = -1;
@@ -3582,91 +4441,250 @@ should_process_subspace(asection *subsection, asection *section)
     return true;
 }
 
-static asection *
-find_next_space(asection *section)
+/* Start building the metadata regions of ABFD, the head up to
+   HEAD_END and the tail from TAIL_START to TAIL_END, in memory.  */
+
+static bool
+som_begin_output_images(bfd *abfd, file_ptr head_end,
+                        file_ptr tail_start, file_ptr tail_end)
+{
+    struct som_output_image *images = som_private_data(abfd)->images;
+
+    images[0].start = 0;
+    images[0].size = head_end;
+    images[1].start = tail_start;
+    images[1].size = tail_end - tail_start;
+    for (unsigned int i = 0; i < 2; i++)
+    {
+        images[i].buf = bfd_zmalloc(images[i].size + 1);
+        if (images[i].buf == NULL)
+            return false;
+    }
+    return true;
+}
+
+/* Write out the metadata regions of ABFD and release them.  */
+
+static bool
+som_flush_output_images(bfd *abfd)
+{
+    struct som_output_image *images = som_private_data(abfd)->images;
+
+    for (unsigned int i = 0; i < 2; i++)
+    {
+        if (images[i].size == 0)
+            continue;
+        SOM_STAT_ADD(abfd, seeks, 1);
+        SOM_STAT_ADD(abfd, writes, 1);
+        SOM_STAT_ADD(abfd, bytes_written, images[i].size);
+        if (bfd_seek(abfd, images[i].start, SEEK_SET) != 0
+            || bfd_write(images[i].buf, images[i].size, abfd) != images[i].size)
+            return false;
+    }
+    return true;
+}
+
+static void
+som_free_output_images(bfd *abfd)
+{
+    struct som_output_image *images = som_private_data(abfd)->images;
+
+    for (unsigned int i = 0; i < 2; i++)
+    {
+        free(images[i].buf);
+        memset(&images[i], 0, sizeof(images[i]));
+    }
+}
+
+/* Return where the SIZE bytes for file offset POS of ABFD go in its
+   metadata images, or NULL if no image covers them.  */
+
+static bfd_byte *
+som_output_image_ptr(bfd *abfd, file_ptr pos, size_t size)
+{
+    struct som_output_image *images = som_private_data(abfd)->images;
+
+    for (unsigned int i = 0; i < 2; i++)
+        if (images[i].buf != NULL
+            && pos >= images[i].start
+            && (size_t) (pos - images[i].start) <= images[i].size
+            && size <= images[i].size - (pos - images[i].start))
+            return images[i].buf + (pos - images[i].start);
+    return NULL;
+}
+
+/* Write SIZE bytes from DATA at file offset POS of ABFD, into its
+   metadata images if they cover it and to the file otherwise.  */
+
+static bool
+som_output_put(bfd *abfd, file_ptr pos, const void *data, size_t size)
+{
+    bfd_byte *dst;
+
+    if (size == 0)
+        return true;
+    dst = som_output_image_ptr(abfd, pos, size);
+    if (dst != NULL)
+    {
+        memcpy(dst, data, size);
+        return true;
+    }
+    return (bfd_seek(abfd, pos, SEEK_SET) == 0
+            && bfd_write(data, size, abfd) == size);
+}
+
+/* Return a zeroed buffer for the SIZE bytes to go at file offset POS
+   of ABFD: their place in the metadata images if there is one, else
+   a buffer for som_output_done to write and free.  */
+
+static void *
+som_output_buffer(bfd *abfd, file_ptr pos, size_t size)
+{
+    void *buf = som_output_image_ptr(abfd, pos, size);
+
+    if (buf != NULL)
+        return buf;
+    return bfd_zmalloc(size + 1);
+}
+
+/* Finish with BUF from som_output_buffer, writing it out if WRITE.  */
+
+static bool
+som_output_done(bfd *abfd, file_ptr pos, void *buf, size_t size, bool write)
+{
+    bool ok = true;
+
+    if (som_output_image_ptr(abfd, pos, size) == buf)
+        return true;
+    if (write)
+        ok = (bfd_seek(abfd, pos, SEEK_SET) == 0
+              && bfd_write(buf, size, abfd) == size);
+    free(buf);
+    return ok;
+}
+
+/* The fixup streams of every subspace of an output BFD, as encoded
+   by som_encode_fixups.  */
+
+struct som_fixup_image
+{
+    struct som_fixup_stream *streams;
+    unsigned int count;
+    unsigned int total_size;
+};
+
+static void
+som_free_fixup_image(struct som_fixup_image *image)
 {
-    while (section && !som_is_space(section))
-        section = section->next;
-    return section;
+    if (image->streams != NULL)
+        for (unsigned int i = 0; i < image->count; i++)
+            free(image->streams[i].buf);
+    free(image->streams);
+    memset(image, 0, sizeof(*image));
 }
 
+/* Encode the fixup streams of every subspace into IMAGE, in subspace
+   order.  Each stream is encoded on its own first, and a running sum
+   over their sizes then gives each subspace its fixup_request_index.
+   Nothing is written to ABFD.  */
+
 static bool
-som_write_fixups(bfd *abfd,
-                unsigned long current_offset,
-                unsigned int *total_reloc_sizep)
+som_encode_fixups(bfd *abfd, struct som_fixup_image *image)
 {
-    unsigned char tmp_space[SOM_TMP_BUFSIZE];
+    struct som_private_data *sdata = som_private_data(abfd);
+    unsigned int num_streams = 0, n, i;
     unsigned int total_reloc_size = 0;
-    unsigned int num_spaces = obj_som_file_hdr(abfd)->space_total;
-    asection *section = abfd->sections;
     
-    memset(tmp_space, 0, SOM_TMP_BUFSIZE);
+    memset(image, 0, sizeof(*image));
+    for (i = 0; i < sdata->space_group_count; i++)
+        num_streams += sdata->space_groups[i].count;
+    
+    image->streams = bfd_zmalloc(num_streams * sizeof(*image->streams) + 1);
+    if (image->streams == NULL)
+        return false;
     
-    for (unsigned int i = 0; i < num_spaces; i++)
+    n = 0;
+    for (i = 0; i < sdata->space_group_count; i++)
     {
-        section = find_next_space(section);
-        if (!section)
-            break;
+        struct som_space_group *group = &sdata->space_groups[i];
         
-        for (asection *subsection = abfd->sections; subsection != NULL; subsection = subsection->next)
+        for (unsigned int j = 0; j < group->count; j++)
         {
-            if (!should_process_subspace(subsection, section))
+            asection *subsection = group->subspaces[j];
+            
+            if (!should_process_subspace(subsection))
                 continue;
             
-            if (!process_subspace_relocations(abfd, subsection, tmp_space, current_offset, &total_reloc_size))
-                return false;
+            if (!process_subspace_relocations(abfd, subsection,
+                                              &image->streams[n]))
+                goto error_return;
+            n++;
+            image->count = n;
         }
+    }
+    
+    for (i = 0; i < n; i++)
+    {
+        struct som_fixup_stream *stream = &image->streams[i];
         
-        section = section->next;
+        if (total_reloc_size + stream->size < total_reloc_size)
+        {
+            bfd_set_error(bfd_error_file_too_big);
+            goto error_return;
+        }
+        som_section_data(stream->subspace)->subspace_dict->fixup_request_index
+            = total_reloc_size;
+        total_reloc_size += stream->size;
     }
     
-    *total_reloc_sizep = total_reloc_size;
+    image->total_size = total_reloc_size;
     return true;
+    
+ error_return:
+    som_free_fixup_image(image);
+    return false;
 }
 
-/* Write the length of STR followed by STR to P which points into
-   *BUF, a buffer of *BUFLEN size.  Track total size in *STRINGS_SIZE,
-   setting *STRX to the current offset for STR.  When STR can't fit in
-   *BUF, flush the buffer to ABFD, possibly reallocating.  Return the
-   next available location in *BUF, or NULL on error.  */
+/* Write the fixup streams in IMAGE to the fixup area starting at
+   CURRENT_OFFSET.  */
 
-static char *flush_buffer(char *p, char **buf, bfd *abfd)
+static bool
+som_write_fixups(bfd *abfd, unsigned long current_offset,
+                 const struct som_fixup_image *image)
 {
-    size_t amt = p - *buf;
-    if (bfd_write(*buf, amt, abfd) != amt)
-        return NULL;
-    return *buf;
+    for (unsigned int i = 0; i < image->count; i++)
+    {
+        if (!som_output_put(abfd, current_offset, image->streams[i].buf,
+                            image->streams[i].size))
+            return false;
+        current_offset += image->streams[i].size;
+    }
+    return true;
 }
 
-static char *reallocate_buffer_if_needed(char **buf, size_t *buflen, size_t needed)
-{
-    if (needed <= *buflen)
-        return *buf;
-    
-    const size_t MIN_GROWTH_FACTOR = 2;
-    size_t new_size = *buflen * MIN_GROWTH_FACTOR;
-    if (new_size < needed)
-        new_size = needed;
-    
-    *buflen = new_size;
-    free(*buf);
-    *buf = bfd_malloc(*buflen);
-    return *buf;
-}
+/* Make room for NEEDED more bytes at P, which points into *BUF, a
+   buffer of *BUFLEN size, growing the buffer if need be.  Return the
+   possibly moved P, or NULL on error.  */
 
-static char *ensure_buffer_space(char *p, char **buf, size_t *buflen, size_t needed, bfd *abfd)
+static char *ensure_buffer_space(char *p, char **buf, size_t *buflen, size_t needed)
 {
-    if (p - *buf + needed <= *buflen)
+    size_t used = p - *buf;
+    size_t new_size;
+    char *new_buf;
+
+    if (used + needed <= *buflen)
         return p;
-    
-    p = flush_buffer(p, buf, abfd);
-    if (p == NULL)
-        return NULL;
-    
-    if (reallocate_buffer_if_needed(buf, buflen, needed) == NULL)
+
+    new_size = *buflen * 2;
+    if (new_size < used + needed)
+        new_size = used + needed;
+    new_buf = bfd_realloc(*buf, new_size);
+    if (new_buf == NULL)
         return NULL;
-    
-    return *buf;
+
+    *buf = new_buf;
+    *buflen = new_size;
+    return new_buf + used;
 }
 
 static char *write_string_length(char *p, size_t length, bfd *abfd, unsigned int *strings_size)
@@ -3697,15 +4715,37 @@ static char *add_padding(char *p, size_t length, unsigned int *strings_size)
     return p + padding;
 }
 
+/* Return the number of bytes add_string uses for a string of LENGTH
+   bytes, counting its terminating NUL: the length word, the string
+   and padding to a word boundary.  */
+
+static size_t string_entry_bytes(size_t length)
+{
+    const size_t ENTRY_OVERHEAD = 4;
+    const size_t ALIGNMENT_MASK = 3;
+    return (ENTRY_OVERHEAD + length + ALIGNMENT_MASK) & ~ALIGNMENT_MASK;
+}
+
+/* Return the number of bytes add_string uses for STR.  */
+
+static size_t string_entry_size(const char *str)
+{
+    return string_entry_bytes(strlen(str) + 1);
+}
+
+/* Write the length of STR followed by STR to P which points into
+   *BUF, a buffer of *BUFLEN size, growing the buffer if STR does not
+   fit.  Track total size in *STRINGS_SIZE, setting *STRX to the
+   current offset for STR.  Return the next available location in
+   *BUF, or NULL on error.  */
+
 static char *add_string(char *p, const char *str, bfd *abfd, char **buf, size_t *buflen,
                        unsigned int *strings_size, unsigned int *strx)
 {
     size_t length = strlen(str) + 1;
-    const size_t ENTRY_OVERHEAD = 4;
-    const size_t ALIGNMENT_MASK = 3;
-    size_t needed = (ENTRY_OVERHEAD + length + ALIGNMENT_MASK) & ~ALIGNMENT_MASK;
+    size_t needed = string_entry_bytes(length);
     
-    p = ensure_buffer_space(p, buf, buflen, needed, abfd);
+    p = ensure_buffer_space(p, buf, buflen, needed);
     if (p == NULL)
         return NULL;
     
@@ -3717,92 +4757,209 @@ static char *add_string(char *p, const char *str, bfd *abfd, char **buf, size_t
     return p;
 }
 
-/* Write out the space/subspace string table.  */
+/* A string table being built, with each distinct string stored once.
+   SOM string table entries are found through the length word just in
+   front of them, so strings cannot share a tail; only exact
+   duplicates are merged.  */
 
-static bool
-is_space_or_subspace(asection *section, unsigned int **strx)
+struct som_string_pool
 {
-    if (som_is_space(section)) {
-        *strx = &som_section_data(section)->space_dict->name;
-        return true;
-    }
-    if (som_is_subspace(section)) {
-        *strx = &som_section_data(section)->subspace_dict->name;
-        return true;
-    }
-    return false;
-}
+  htab_t htab;
+  struct som_string_pool_entry *entries;
+  size_t used;
+};
 
-static bool
-write_section_strings(bfd *abfd, char **p, char **tmp_space, 
-                     size_t *tmp_space_size, unsigned int *strings_size)
+struct som_string_pool_entry
 {
-    asection *section;
-    
-    for (section = abfd->sections; section != NULL; section = section->next) {
-        unsigned int *strx;
-        
-        if (!is_space_or_subspace(section, &strx))
-            continue;
-        
-        *p = add_string(*p, section->name, abfd, tmp_space, tmp_space_size,
-                       strings_size, strx);
-        if (*p == NULL)
-            return false;
-    }
-    return true;
+  const char *str;
+  hashval_t hash;
+  unsigned int strx;
+};
+
+static hashval_t
+som_string_pool_hash (const void *p)
+{
+  return ((const struct som_string_pool_entry *) p)->hash;
 }
 
-static bool
-write_partial_block(bfd *abfd, char *tmp_space, char *p)
+static int
+som_string_pool_eq (const void *p1, const void *p2)
 {
-    size_t amt = p - tmp_space;
-    if (amt == 0)
-        return true;
-    return bfd_write(tmp_space, amt, abfd) == amt;
+  const struct som_string_pool_entry *e1 = p1;
+  const struct som_string_pool_entry *e2 = p2;
+
+  return e1->hash == e2->hash && strcmp (e1->str, e2->str) == 0;
 }
 
+/* Set up POOL for at most COUNT strings.  */
+
 static bool
-som_write_space_strings(bfd *abfd,
-                       unsigned long current_offset,
-                       unsigned int *strings_size)
+som_string_pool_init (struct som_string_pool *pool, size_t count)
 {
-    size_t tmp_space_size = SOM_TMP_BUFSIZE;
-    char *tmp_space = bfd_malloc(tmp_space_size);
-    char *p = tmp_space;
-    bool ok;
-    
-    if (tmp_space == NULL)
-        return false;
-    
-    if (bfd_seek(abfd, current_offset, SEEK_SET) != 0) {
-        free(tmp_space);
-        return false;
+  size_t amt;
+
+  pool->used = 0;
+  pool->entries = NULL;
+  pool->htab = htab_try_create (count, som_string_pool_hash,
+				som_string_pool_eq, NULL);
+  if (pool->htab == NULL)
+    {
+      bfd_set_error (bfd_error_no_memory);
+      return false;
     }
+
+  if (_bfd_mul_overflow (count, sizeof (*pool->entries), &amt))
+    {
+      bfd_set_error (bfd_error_file_too_big);
+      htab_delete (pool->htab);
+      return false;
+    }
+  pool->entries = bfd_malloc (amt + 1);
+  if (pool->entries == NULL)
+    {
+      htab_delete (pool->htab);
+      return false;
+    }
+  return true;
+}
+
+static void
+som_string_pool_free (struct som_string_pool *pool)
+{
+  htab_delete (pool->htab);
+  free (pool->entries);
+}
+
+/* Like add_string, but if STR is already in POOL just set *STRX to
+   where it was put.  */
+
+static char *add_pooled_string(char *p, const char *str, bfd *abfd, char **buf,
+                               size_t *buflen, unsigned int *strings_size,
+                               unsigned int *strx, struct som_string_pool *pool)
+{
+    struct som_string_pool_entry *entry = &pool->entries[pool->used];
+    void **slot;
     
-    *strings_size = 0;
+    entry->str = str;
+    entry->hash = htab_hash_string(str);
+    slot = htab_find_slot_with_hash(pool->htab, entry, entry->hash, INSERT);
+    if (slot == NULL)
+    {
+        bfd_set_error(bfd_error_no_memory);
+        return NULL;
+    }
     
-    if (!write_section_strings(abfd, &p, &tmp_space, &tmp_space_size, strings_size)) {
-        free(tmp_space);
-        return false;
+    if (*slot != NULL)
+    {
+        *strx = ((struct som_string_pool_entry *) *slot)->strx;
+        return p;
     }
     
-    ok = write_partial_block(abfd, tmp_space, p);
-    free(tmp_space);
-    return ok;
+    p = add_string(p, str, abfd, buf, buflen, strings_size, strx);
+    if (p == NULL)
+    {
+        htab_clear_slot(pool->htab, slot);
+        return NULL;
+    }
+    
+    entry->strx = *strx;
+    *slot = entry;
+    pool->used++;
+    return p;
+}
+
+/* Write out the space/subspace string table.  */
+
+static bool
+is_space_or_subspace(asection *section, unsigned int **strx)
+{
+    if (som_is_space(section)) {
+        *strx = &som_section_data(section)->space_dict->name;
+        return true;
+    }
+    if (som_is_subspace(section)) {
+        *strx = &som_section_data(section)->subspace_dict->name;
+        return true;
+    }
+    return false;
+}
+
+static bool
+write_section_strings(bfd *abfd, char **p, char **tmp_space, 
+                     size_t *tmp_space_size, unsigned int *strings_size,
+                     struct som_string_pool *pool)
+{
+    asection *section;
+    
+    for (section = abfd->sections; section != NULL; section = section->next) {
+        unsigned int *strx;
+        
+        if (!is_space_or_subspace(section, &strx))
+            continue;
+        
+        *p = add_pooled_string(*p, section->name, abfd, tmp_space,
+                               tmp_space_size, strings_size, strx, pool);
+        if (*p == NULL)
+            return false;
+    }
+    return true;
 }
 
-/* Write out the symbol string table.  */
+/* Build the space/subspace string table of ABFD in memory, setting
+   the name index of every space and subspace.  Return the table in
+   *BUFP (to be freed by the caller) and its size in *STRINGS_SIZE.  */
 
 static bool
-write_final_block(bfd *abfd, char *tmp_space, char *p)
+som_build_space_strings(bfd *abfd, char **bufp, unsigned int *strings_size)
 {
-  size_t amt = p - tmp_space;
-  if (amt == 0)
+    size_t tmp_space_size = 1;
+    size_t count = 0;
+    char *tmp_space;
+    char *p;
+    struct som_string_pool pool;
+    bool ok;
+    
+    /* Size the buffer for the whole table up front.  */
+    for (asection *section = abfd->sections; section != NULL; section = section->next)
+    {
+        unsigned int *strx;
+        
+        if (is_space_or_subspace(section, &strx))
+        {
+            tmp_space_size += string_entry_size(section->name);
+            count++;
+        }
+    }
+    
+    if (!som_string_pool_init(&pool, count))
+        return false;
+    
+    tmp_space = bfd_malloc(tmp_space_size);
+    p = tmp_space;
+    if (tmp_space == NULL) {
+        som_string_pool_free(&pool);
+        return false;
+    }
+    
+    *strings_size = 0;
+    
+    ok = write_section_strings(abfd, &p, &tmp_space, &tmp_space_size,
+                               strings_size, &pool);
+    som_string_pool_free(&pool);
+    if (!ok)
+    {
+        free(tmp_space);
+        return false;
+    }
+    *bufp = tmp_space;
     return true;
-  return bfd_write(tmp_space, amt, abfd) == amt;
 }
 
+/* Build the symbol string table.  */
+
+/* Number of names in a compilation unit record.  */
+#define NUM_COMPILATION_UNIT_NAMES 4
+
 static struct som_name_pt*
 get_compilation_unit_name(struct som_compilation_unit *compilation_unit, unsigned int index)
 {
@@ -3824,12 +4981,12 @@ get_compilation_unit_name(struct som_compilation_unit *compilation_unit, unsigne
 static char*
 write_compilation_unit_strings(bfd *abfd,
                                struct som_compilation_unit *compilation_unit,
-                               char *tmp_space,
+                               char **tmp_space,
                                size_t *tmp_space_size,
                                unsigned int *strings_size,
-                               char *p)
+                               char *p,
+                               struct som_string_pool *pool)
 {
-  const unsigned int NUM_COMPILATION_UNIT_NAMES = 4;
   unsigned int i;
   
   if (!compilation_unit)
@@ -3838,8 +4995,8 @@ write_compilation_unit_strings(bfd *abfd,
   for (i = 0; i < NUM_COMPILATION_UNIT_NAMES; i++)
     {
       struct som_name_pt *name = get_compilation_unit_name(compilation_unit, i);
-      p = add_string(p, name->name, abfd, &tmp_space, tmp_space_size,
-                    strings_size, &name->strx);
+      p = add_pooled_string(p, name->name, abfd, tmp_space, tmp_space_size,
+                            strings_size, &name->strx, pool);
       if (p == NULL)
         return NULL;
     }
@@ -3850,72 +5007,99 @@ static char*
 write_symbol_strings(bfd *abfd,
                     asymbol **syms,
                     unsigned int num_syms,
-                    char *tmp_space,
+                    char **tmp_space,
                     size_t *tmp_space_size,
                     unsigned int *strings_size,
-                    char *p)
+                    char *p,
+                    struct som_string_pool *pool)
 {
   unsigned int i;
   
   for (i = 0; i < num_syms; i++)
     {
-      p = add_string(p, syms[i]->name, abfd, &tmp_space, tmp_space_size,
-                    strings_size,
-                    &som_symbol_data(syms[i])->stringtab_offset);
+      p = add_pooled_string(p, syms[i]->name, abfd, tmp_space, tmp_space_size,
+                            strings_size,
+                            &som_symbol_data(syms[i])->stringtab_offset,
+                            pool);
       if (p == NULL)
         return NULL;
     }
   return p;
 }
 
+/* Build the symbol string table of ABFD in memory: the names of the
+   compilation unit followed by those of the NUM_SYMS symbols in SYMS,
+   setting the string table offset of each.  Return the table in *BUFP
+   (to be freed by the caller) and its size in *STRINGS_SIZE.  */
+
 static bool
-som_write_symbol_strings(bfd *abfd,
-                        unsigned long current_offset,
-                        asymbol **syms,
-                        unsigned int num_syms,
-                        unsigned int *strings_size,
-                        struct som_compilation_unit *compilation_unit)
-{
-  size_t tmp_space_size = SOM_TMP_BUFSIZE;
-  char *tmp_space = bfd_malloc(tmp_space_size);
-  char *p = tmp_space;
-  bool ok;
+som_build_symbol_strings(bfd *abfd,
+                         asymbol **syms,
+                         unsigned int num_syms,
+                         struct som_compilation_unit *compilation_unit,
+                         char **bufp,
+                         unsigned int *strings_size)
+{
+  size_t tmp_space_size = 1;
+  char *tmp_space;
+  char *p;
+  unsigned int i;
+  struct som_string_pool pool;
+
+  /* Size the buffer for the whole table up front.  */
+  if (compilation_unit)
+    for (i = 0; i < NUM_COMPILATION_UNIT_NAMES; i++)
+      tmp_space_size
+	+= string_entry_size (get_compilation_unit_name (compilation_unit,
+							 i)->name);
+  for (i = 0; i < num_syms; i++)
+    tmp_space_size += string_entry_size (syms[i]->name);
 
-  if (tmp_space == NULL)
+  if (!som_string_pool_init (&pool,
+			      (size_t) num_syms + NUM_COMPILATION_UNIT_NAMES))
     return false;
 
-  if (bfd_seek(abfd, current_offset, SEEK_SET) != 0)
+  tmp_space = bfd_malloc(tmp_space_size);
+  p = tmp_space;
+  if (tmp_space == NULL)
     {
-      free(tmp_space);
+      som_string_pool_free (&pool);
       return false;
     }
 
   *strings_size = 0;
-  
-  p = write_compilation_unit_strings(abfd, compilation_unit, tmp_space,
-                                     &tmp_space_size, strings_size, p);
-  if (p == NULL)
-    {
-      free(tmp_space);
-      return false;
-    }
 
-  p = write_symbol_strings(abfd, syms, num_syms, tmp_space,
-                          &tmp_space_size, strings_size, p);
+  p = write_compilation_unit_strings(abfd, compilation_unit, &tmp_space,
+                                     &tmp_space_size, strings_size, p, &pool);
+  if (p != NULL)
+    p = write_symbol_strings(abfd, syms, num_syms, &tmp_space,
+                             &tmp_space_size, strings_size, p, &pool);
+
+  som_string_pool_free (&pool);
   if (p == NULL)
     {
       free(tmp_space);
       return false;
     }
-
-  ok = write_final_block(abfd, tmp_space, p);
-  free(tmp_space);
-  return ok;
+  *bufp = tmp_space;
+  return true;
 }
 
 /* Compute variable information to be placed in the SOM headers,
-   space/subspace dictionaries, relocation streams, etc.  Begin
-   writing parts of the object file.  */
+   space/subspace dictionaries, relocation streams, etc.  The layout
+   functions below only fill in the headers; the matching writers
+   then put out what was laid out.  */
+
+static void
+layout_string_auxhdr(bfd *abfd, unsigned long *current_offset,
+                     struct som_string_auxhdr *hdr)
+{
+  bfd_size_type len;
+
+  len = sizeof(struct som_external_string_auxhdr) + hdr->header_id.length - 4;
+  obj_som_file_hdr(abfd)->aux_header_size += len;
+  *current_offset += len;
+}
 
 static bool
 write_string_auxhdr(bfd *abfd, unsigned long *current_offset, 
@@ -3924,21 +5108,16 @@ write_string_auxhdr(bfd *abfd, unsigned long *current_offset,
   struct som_external_string_auxhdr ext_string_auxhdr;
   bfd_size_type len;
 
-  if (bfd_seek(abfd, *current_offset, SEEK_SET) != 0)
-    return false;
-
   len = sizeof(struct som_external_string_auxhdr);
-  obj_som_file_hdr(abfd)->aux_header_size += len;
-  *current_offset += len;
   som_swap_string_auxhdr_out(hdr, &ext_string_auxhdr);
-  if (bfd_write(&ext_string_auxhdr, len, abfd) != len)
+  if (!som_output_put(abfd, *current_offset, &ext_string_auxhdr, len))
     return false;
+  *current_offset += len;
 
   len = hdr->header_id.length - 4;
-  obj_som_file_hdr(abfd)->aux_header_size += len;
-  *current_offset += len;
-  if (bfd_write(hdr->string, len, abfd) != len)
+  if (!som_output_put(abfd, *current_offset, hdr->string, len))
     return false;
+  *current_offset += len;
 
   return true;
 }
@@ -3956,8 +5135,8 @@ setup_exec_header(bfd *abfd, unsigned long *current_offset)
   exec_header->som_auxhdr.length = 40;
 }
 
-static bool
-write_auxiliary_headers(bfd *abfd, unsigned long *current_offset)
+static void
+layout_auxiliary_headers(bfd *abfd, unsigned long *current_offset)
 {
   obj_som_file_hdr(abfd)->aux_header_location = *current_offset;
   obj_som_file_hdr(abfd)->aux_header_size = 0;
@@ -3966,11 +5145,30 @@ write_auxiliary_headers(bfd *abfd, unsigned long *current_offset)
     setup_exec_header(abfd, current_offset);
 
   if (obj_som_version_hdr(abfd) != NULL)
-    if (!write_string_auxhdr(abfd, current_offset, obj_som_version_hdr(abfd)))
+    layout_string_auxhdr(abfd, current_offset, obj_som_version_hdr(abfd));
+
+  if (obj_som_copyright_hdr(abfd) != NULL)
+    layout_string_auxhdr(abfd, current_offset, obj_som_copyright_hdr(abfd));
+}
+
+/* Write the string auxiliary headers laid out by
+   layout_auxiliary_headers.  The exec header in front of them is
+   written last, by write_exec_header.  */
+
+static bool
+write_auxiliary_headers(bfd *abfd)
+{
+  unsigned long current_offset = obj_som_file_hdr(abfd)->aux_header_location;
+
+  if (abfd->flags & (EXEC_P | DYNAMIC))
+    current_offset += sizeof(struct som_external_exec_auxhdr);
+
+  if (obj_som_version_hdr(abfd) != NULL)
+    if (!write_string_auxhdr(abfd, &current_offset, obj_som_version_hdr(abfd)))
       return false;
 
   if (obj_som_copyright_hdr(abfd) != NULL)
-    if (!write_string_auxhdr(abfd, current_offset, obj_som_copyright_hdr(abfd)))
+    if (!write_string_auxhdr(abfd, &current_offset, obj_som_copyright_hdr(abfd)))
       return false;
 
   return true;
@@ -3997,7 +5195,7 @@ setup_subspace_records(bfd *abfd, unsigned long *current_offset)
 }
 
 static bool
-write_string_table(bfd *abfd, unsigned long *current_offset)
+layout_string_table(bfd *abfd, unsigned long *current_offset, char **strings)
 {
   unsigned int strings_size = 0;
   
@@ -4006,7 +5204,7 @@ write_string_table(bfd *abfd, unsigned long *current_offset)
 
   obj_som_file_hdr(abfd)->space_strings_location = *current_offset;
   
-  if (!som_write_space_strings(abfd, *current_offset, &strings_size))
+  if (!som_build_space_strings(abfd, strings, &strings_size))
     return false;
 
   obj_som_file_hdr(abfd)->space_strings_size = strings_size;
@@ -4015,6 +5213,15 @@ write_string_table(bfd *abfd, unsigned long *current_offset)
   return true;
 }
 
+static bool
+write_string_table(bfd *abfd, const char *strings)
+{
+  file_ptr location = obj_som_file_hdr(abfd)->space_strings_location;
+  size_t amt = obj_som_file_hdr(abfd)->space_strings_size;
+
+  return som_output_put(abfd, location, strings, amt);
+}
+
 static void
 setup_compilation_unit(bfd *abfd, unsigned long *current_offset)
 {
@@ -4095,20 +5302,20 @@ process_loadable_subsection(bfd *abfd, asection *subsection,
 }
 
 static void
-process_loadable_subspaces(bfd *abfd, asection *section,
+process_loadable_subspaces(bfd *abfd, struct som_space_group *group,
                           unsigned long *current_offset,
                           unsigned int *total_subspaces,
                           struct som_exec_auxhdr *exec_header)
 {
-  asection *subsection;
+  asection *section = group->space;
   int first_subspace = 1;
   unsigned int subspace_offset = 0;
 
-  for (subsection = abfd->sections; subsection; subsection = subsection->next)
+  for (unsigned int j = 0; j < group->count; j++)
   {
-    if (!som_is_subspace(subsection)
-        || !som_is_container(section, subsection)
-        || (subsection->flags & SEC_ALLOC) == 0)
+    asection *subsection = group->subspaces[j];
+
+    if ((subsection->flags & SEC_ALLOC) == 0)
       continue;
 
     if (first_subspace && (abfd->flags & (EXEC_P | DYNAMIC)))
@@ -4152,20 +5359,18 @@ process_unloadable_subsection(asection *subsection, unsigned long *current_offse
 }
 
 static void
-process_unloadable_subspaces(bfd *abfd, asection *section,
+process_unloadable_subspaces(bfd *abfd, struct som_space_group *group,
                             unsigned long *current_offset,
                             unsigned int *total_subspaces)
 {
-  asection *subsection;
-
   if (abfd->flags & (EXEC_P | DYNAMIC))
     *current_offset = SOM_ALIGN(*current_offset, PA_PAGESIZE);
 
-  for (subsection = abfd->sections; subsection; subsection = subsection->next)
+  for (unsigned int j = 0; j < group->count; j++)
   {
-    if (!som_is_subspace(subsection)
-        || !som_is_container(section, subsection)
-        || (subsection->flags & SEC_ALLOC) != 0)
+    asection *subsection = group->subspaces[j];
+
+    if ((subsection->flags & SEC_ALLOC) != 0)
       continue;
 
     subsection->target_index = (*total_subspaces)++;
@@ -4173,14 +5378,6 @@ process_unloadable_subspaces(bfd *abfd, asection *section,
   }
 }
 
-static asection *
-find_next_space(asection *section)
-{
-  while (!som_is_space(section))
-    section = section->next;
-  return section;
-}
-
 static bool
 finalize_file(bfd *abfd, unsigned long current_offset)
 {
@@ -4195,22 +5392,45 @@ finalize_file(bfd *abfd, unsigned long current_offset)
   return true;
 }
 
+/* Reset the parts of the exec header accumulated by the layout of
+   the subspaces, so that laying out again gives the same result.  */
+
+static void
+reset_exec_header_layout(struct som_exec_auxhdr *exec_header)
+{
+  exec_header->exec_tsize = 0;
+  exec_header->exec_tmem = 0;
+  exec_header->exec_tfile = 0;
+  exec_header->exec_dsize = 0;
+  exec_header->exec_dmem = 0;
+  exec_header->exec_dfile = 0;
+  exec_header->exec_bsize = 0;
+}
+
+/* Lay out everything up to and including the subspace contents: the
+   headers, the dictionaries, the space strings (returned in *STRINGS
+   for the caller to write and free) and the contents area.  Nothing is
+   written to ABFD.  */
+
 static bool
-som_begin_writing(bfd *abfd)
+som_layout_head(bfd *abfd, char **strings)
 {
   unsigned long current_offset = 0;
-  unsigned long num_spaces, i;
-  asection *section;
+  struct som_private_data *sdata = som_private_data(abfd);
+  unsigned int i;
   unsigned int total_subspaces = 0;
   struct som_exec_auxhdr *exec_header = NULL;
 
+  *strings = NULL;
   current_offset += sizeof(struct som_external_header);
 
-  if (!write_auxiliary_headers(abfd, &current_offset))
-    return false;
+  layout_auxiliary_headers(abfd, &current_offset);
 
   if (abfd->flags & (EXEC_P | DYNAMIC))
-    exec_header = obj_som_exec_hdr(abfd);
+    {
+      exec_header = obj_som_exec_hdr(abfd);
+      reset_exec_header_layout(exec_header);
+    }
 
   obj_som_file_hdr(abfd)->init_array_location = current_offset;
   obj_som_file_hdr(abfd)->init_array_total = 0;
@@ -4218,38 +5438,24 @@ som_begin_writing(bfd *abfd)
   setup_space_records(abfd, &current_offset);
   setup_subspace_records(abfd, &current_offset);
 
-  if (!write_string_table(abfd, &current_offset))
+  if (!layout_string_table(abfd, &current_offset, strings))
     return false;
 
   setup_compilation_unit(abfd, &current_offset);
+  sdata->head_end = current_offset;
 
-  num_spaces = obj_som_file_hdr(abfd)->space_total;
-  section = abfd->sections;
-  
-  for (i = 0; i < num_spaces; i++)
-  {
-    section = find_next_space(section);
-    process_loadable_subspaces(abfd, section, &current_offset,
+  for (i = 0; i < sdata->space_group_count; i++)
+    process_loadable_subspaces(abfd, &sdata->space_groups[i], &current_offset,
                               &total_subspaces, exec_header);
-    section = section->next;
-  }
 
   if (abfd->flags & (EXEC_P | DYNAMIC))
     current_offset = SOM_ALIGN(current_offset, PA_PAGESIZE);
 
   obj_som_file_hdr(abfd)->unloadable_sp_location = current_offset;
-  section = abfd->sections;
   
-  for (i = 0; i < num_spaces; i++)
-  {
-    section = find_next_space(section);
-    process_unloadable_subspaces(abfd, section, &current_offset,
+  for (i = 0; i < sdata->space_group_count; i++)
+    process_unloadable_subspaces(abfd, &sdata->space_groups[i], &current_offset,
                                 &total_subspaces);
-    section = section->next;
-  }
-
-  if (!finalize_file(abfd, current_offset))
-    return false;
 
   obj_som_file_hdr(abfd)->unloadable_sp_size =
     current_offset - obj_som_file_hdr(abfd)->unloadable_sp_location;
@@ -4257,10 +5463,30 @@ som_begin_writing(bfd *abfd)
   obj_som_file_hdr(abfd)->loader_fixup_location = 0;
   obj_som_file_hdr(abfd)->loader_fixup_total = 0;
   obj_som_file_hdr(abfd)->som_length = current_offset;
+  sdata->contents_end = current_offset;
 
   return true;
 }
 
+/* Lay out the output file and extend it to the end of the contents.
+   The metadata in front of the contents is written by
+   som_finish_writing.  */
+
+static bool
+som_begin_writing(bfd *abfd)
+{
+  struct som_private_data *sdata = som_private_data(abfd);
+  bool ok;
+  SOM_STAT_TIMER_START(start);
+
+  free(sdata->space_strings);
+  sdata->space_strings = NULL;
+  ok = (som_layout_head(abfd, &sdata->space_strings)
+        && finalize_file(abfd, sdata->contents_end));
+  SOM_STAT_TIMER_STOP(abfd, begin_writing_time, start);
+  return ok;
+}
+
 /* Finally, scribble out the various headers to the disk.  */
 
 static bool
@@ -4293,7 +5519,7 @@ setup_symbol_table_location(bfd *abfd, unsigned long current_offset)
 }
 
 static unsigned long
-write_symbol_strings_section(bfd *abfd, unsigned long current_offset)
+layout_symbol_strings(bfd *abfd, unsigned long current_offset, char **strings)
 {
   unsigned int strings_size;
   asymbol **syms = bfd_get_outsymbols(abfd);
@@ -4302,8 +5528,9 @@ write_symbol_strings_section(bfd *abfd, unsigned long current_offset)
   current_offset = align_to_word_boundary(current_offset);
   obj_som_file_hdr(abfd)->symbol_strings_location = current_offset;
   
-  if (!som_write_symbol_strings(abfd, current_offset, syms, num_syms, 
-                                &strings_size, obj_som_compilation_unit(abfd)))
+  if (!som_build_symbol_strings(abfd, syms, num_syms,
+                                obj_som_compilation_unit(abfd),
+                                strings, &strings_size))
     return 0;
   
   obj_som_file_hdr(abfd)->symbol_strings_size = strings_size;
@@ -4311,141 +5538,220 @@ write_symbol_strings_section(bfd *abfd, unsigned long current_offset)
 }
 
 static unsigned long
-write_fixup_stream(bfd *abfd, unsigned long current_offset)
+layout_fixup_stream(bfd *abfd, unsigned long current_offset,
+                    struct som_fixup_image *fixups)
 {
-  unsigned int total_reloc_size;
-  
   if (!som_prep_for_fixups(abfd, bfd_get_outsymbols(abfd), bfd_get_symcount(abfd)))
     return 0;
   
   current_offset = align_to_word_boundary(current_offset);
   obj_som_file_hdr(abfd)->fixup_request_location = current_offset;
   
-  if (!som_write_fixups(abfd, current_offset, &total_reloc_size))
+  SOM_STAT_TIMER_START(start);
+  bool ok = som_encode_fixups(abfd, fixups);
+  SOM_STAT_TIMER_STOP(abfd, encode_fixups_time, start);
+  if (!ok)
     return 0;
   
-  obj_som_file_hdr(abfd)->fixup_request_total = total_reloc_size;
-  obj_som_file_hdr(abfd)->som_length = current_offset + total_reloc_size;
+  obj_som_file_hdr(abfd)->fixup_request_total = fixups->total_size;
+  obj_som_file_hdr(abfd)->som_length = current_offset + fixups->total_size;
   
-  return current_offset + total_reloc_size;
+  return current_offset + fixups->total_size;
 }
 
-static asection*
-find_next_space(asection *section)
+/* The symbol strings and fixup streams laid out by som_layout_tail.  */
+
+struct som_tail_image
+{
+  char *symbol_strings;
+  struct som_fixup_image fixups;
+};
+
+static void
+som_free_tail_image(struct som_tail_image *image)
 {
-  while (section && !som_is_space(section))
-    section = section->next;
-  return section;
+  free(image->symbol_strings);
+  image->symbol_strings = NULL;
+  som_free_fixup_image(&image->fixups);
 }
 
+/* Lay out what follows the subspace contents: the symbol table, the
+   symbol strings and the fixup streams, the last two being built in
+   IMAGE.  Nothing is written to ABFD.  */
+
 static bool
-should_write_subspace(asection *subsection, asection *space, bool loadable)
+som_layout_tail(bfd *abfd, struct som_tail_image *image)
 {
-  if (!som_is_subspace(subsection))
-    return false;
-  if (!som_is_container(space, subsection))
-    return false;
+  unsigned long current_offset = som_private_data(abfd)->contents_end;
+
+  memset(image, 0, sizeof(*image));
+  current_offset = setup_symbol_table_location(abfd, current_offset);
   
+  current_offset = layout_symbol_strings(abfd, current_offset,
+                                         &image->symbol_strings);
+  if (current_offset != 0)
+    current_offset = layout_fixup_stream(abfd, current_offset, &image->fixups);
+  if (current_offset == 0)
+  {
+    som_free_tail_image(image);
+    return false;
+  }
+  return true;
+}
+
+static bool
+write_symbol_strings_section(bfd *abfd, const char *strings)
+{
+  file_ptr location = obj_som_file_hdr(abfd)->symbol_strings_location;
+  size_t amt = obj_som_file_hdr(abfd)->symbol_strings_size;
+
+  return som_output_put(abfd, location, strings, amt);
+}
+
+static bool
+write_fixup_stream(bfd *abfd, const struct som_fixup_image *fixups)
+{
+  SOM_STAT_TIMER_START(start);
+  bool ok = som_write_fixups(abfd, obj_som_file_hdr(abfd)->fixup_request_location,
+                             fixups);
+  SOM_STAT_TIMER_STOP(abfd, write_fixups_time, start);
+  return ok;
+}
+
+static bool
+should_write_subspace(asection *subsection, bool loadable)
+{
   bool has_alloc = (subsection->flags & SEC_ALLOC) != 0;
   return loadable ? has_alloc : !has_alloc;
 }
 
-static bool
-write_subspace_record(bfd *abfd, asection *subsection, int space_index)
+static void
+swap_subspace_record(asection *subsection, int space_index,
+                     struct som_external_subspace_dictionary_record *ext)
 {
-  struct som_external_subspace_dictionary_record ext_subspace_dict;
-  size_t amt = sizeof(struct som_subspace_dictionary_record);
-  
   som_section_data(subsection)->subspace_dict->space_index = space_index;
-  som_swap_subspace_dictionary_record_out(som_section_data(subsection)->subspace_dict, 
-                                          &ext_subspace_dict);
-  return bfd_write(&ext_subspace_dict, amt, abfd) == amt;
+  som_swap_subspace_dictionary_record_out(som_section_data(subsection)->subspace_dict,
+                                          ext);
 }
 
 static bool
-process_subspace(bfd *abfd, asection *space, asection *subsection, 
-                 int *subspace_index, int space_index, bool loadable)
+process_subspace(asection *space, asection *subsection,
+                 int *subspace_index, int space_index, bool loadable,
+                 struct som_external_subspace_dictionary_record *ext,
+                 unsigned int ext_count)
 {
+  if ((unsigned int) *subspace_index >= ext_count)
+  {
+    bfd_set_error(bfd_error_bad_value);
+    return false;
+  }
+
   if (som_section_data(space)->space_dict->subspace_quantity == 0)
   {
     som_section_data(space)->space_dict->is_loadable = loadable ? 1 : 0;
     som_section_data(space)->space_dict->subspace_index = *subspace_index;
   }
   
+  swap_subspace_record(subsection, space_index, &ext[*subspace_index]);
   (*subspace_index)++;
   som_section_data(space)->space_dict->subspace_quantity++;
-  
-  return write_subspace_record(abfd, subsection, space_index);
+  return true;
 }
 
 static bool
-write_subspaces_for_type(bfd *abfd, int num_spaces, int *subspace_index, bool loadable)
+write_subspaces_for_type(bfd *abfd, int num_spaces, int *subspace_index, bool loadable,
+                         struct som_external_subspace_dictionary_record *ext,
+                         unsigned int ext_count)
 {
-  asection *section = abfd->sections;
+  struct som_private_data *sdata = som_private_data(abfd);
+  
+  if ((unsigned int) num_spaces > sdata->space_group_count)
+    return false;
   
   for (int i = 0; i < num_spaces; i++)
   {
-    section = find_next_space(section);
-    if (!section)
-      return false;
+    struct som_space_group *group = &sdata->space_groups[i];
     
-    for (asection *subsection = abfd->sections; subsection; subsection = subsection->next)
+    for (unsigned int j = 0; j < group->count; j++)
     {
-      if (!should_write_subspace(subsection, section, loadable))
+      asection *subsection = group->subspaces[j];
+      
+      if (!should_write_subspace(subsection, loadable))
         continue;
       
-      if (!process_subspace(abfd, section, subsection, subspace_index, i, loadable))
+      if (!process_subspace(group->space, subsection, subspace_index, i,
+                            loadable, ext, ext_count))
         return false;
     }
-    
-    section = section->next;
   }
   
   return true;
 }
 
+/* Convert the whole subspace dictionary into one external array and
+   write it with a single write.  */
+
 static bool
 write_all_subspaces(bfd *abfd, int num_spaces)
 {
   int subspace_index = 0;
   file_ptr location = obj_som_file_hdr(abfd)->subspace_location;
+  unsigned int count = obj_som_file_hdr(abfd)->subspace_total;
+  struct som_external_subspace_dictionary_record *ext;
+  size_t amt;
+  bool ok;
   
-  if (bfd_seek(abfd, location, SEEK_SET) != 0)
+  if (count == 0)
+    return true;
+  if (_bfd_mul_overflow (count, sizeof (*ext), &amt))
+  {
+    bfd_set_error (bfd_error_no_memory);
     return false;
-  
-  if (!write_subspaces_for_type(abfd, num_spaces, &subspace_index, true))
+  }
+  ext = som_output_buffer (abfd, location, amt);
+  if (ext == NULL)
     return false;
   
-  return write_subspaces_for_type(abfd, num_spaces, &subspace_index, false);
+  ok = (write_subspaces_for_type(abfd, num_spaces, &subspace_index, true,
+                                 ext, count)
+        && write_subspaces_for_type(abfd, num_spaces, &subspace_index, false,
+                                    ext, count));
+  
+  return som_output_done(abfd, location, ext, amt, ok) && ok;
 }
 
+/* Likewise for the space dictionary.  */
+
 static bool
 write_space_dictionary(bfd *abfd, int num_spaces)
 {
   file_ptr location = obj_som_file_hdr(abfd)->space_location;
-  size_t amt = sizeof(struct som_external_space_dictionary_record);
+  struct som_private_data *sdata = som_private_data(abfd);
+  struct som_external_space_dictionary_record *ext;
+  size_t amt;
+  
+  if ((unsigned int) num_spaces > sdata->space_group_count)
+    return false;
+  if (num_spaces <= 0)
+    return true;
   
-  if (bfd_seek(abfd, location, SEEK_SET) != 0)
+  if (_bfd_mul_overflow (num_spaces, sizeof (*ext), &amt))
+  {
+    bfd_set_error (bfd_error_no_memory);
+    return false;
+  }
+  ext = som_output_buffer (abfd, location, amt);
+  if (ext == NULL)
     return false;
   
-  asection *section = abfd->sections;
   for (int i = 0; i < num_spaces; i++)
   {
-    struct som_external_space_dictionary_record ext_space_dict;
-    
-    section = find_next_space(section);
-    if (!section)
-      return false;
-    
-    som_swap_space_dictionary_out(som_section_data(section)->space_dict, &ext_space_dict);
+    asection *section = sdata->space_groups[i].space;
     
-    if (bfd_write(&ext_space_dict, amt, abfd) != amt)
-      return false;
-    
-    section = section->next;
+    som_swap_space_dictionary_out(som_section_data(section)->space_dict, &ext[i]);
   }
   
-  return true;
+  return som_output_done(abfd, location, ext, amt, true);
 }
 
 static bool
@@ -4458,12 +5764,9 @@ write_compilation_unit(bfd *abfd)
   file_ptr location = obj_som_file_hdr(abfd)->compiler_location;
   size_t amt = sizeof(struct som_external_compilation_unit);
   
-  if (bfd_seek(abfd, location, SEEK_SET) != 0)
-    return false;
-  
   som_swap_compilation_unit_out(obj_som_compilation_unit(abfd), &ext_comp_unit);
   
-  return bfd_write(&ext_comp_unit, amt, abfd) == amt;
+  return som_output_put(abfd, location, &ext_comp_unit, amt);
 }
 
 static void
@@ -4488,10 +5791,7 @@ write_file_header(bfd *abfd)
   som_swap_header_out(obj_som_file_hdr(abfd), &ext_header);
   bfd_putb32(som_compute_checksum(&ext_header), ext_header.checksum);
   
-  if (bfd_seek(abfd, 0, SEEK_SET) != 0)
-    return false;
-  
-  return bfd_write(&ext_header, amt, abfd) == amt;
+  return som_output_put(abfd, 0, &ext_header, amt);
 }
 
 static void
@@ -4538,66 +5838,90 @@ write_exec_header(bfd *abfd)
   
   som_swap_exec_auxhdr_out(exec_header, &ext_exec_header);
   
-  if (bfd_seek(abfd, obj_som_file_hdr(abfd)->aux_header_location, SEEK_SET) != 0)
-    return false;
-  
-  return bfd_write(&ext_exec_header, amt, abfd) == amt;
+  return som_output_put(abfd, obj_som_file_hdr(abfd)->aux_header_location,
+                        &ext_exec_header, amt);
 }
 
 static bool
 som_finish_writing(bfd *abfd)
 {
+  struct som_private_data *sdata = som_private_data(abfd);
   int num_spaces = som_count_spaces(abfd);
-  unsigned long current_offset;
+  struct som_tail_image tail;
+  bool ok;
   
   set_version_id(abfd);
-  
-  current_offset = obj_som_file_hdr(abfd)->som_length;
-  current_offset = setup_symbol_table_location(abfd, current_offset);
-  
-  current_offset = write_symbol_strings_section(abfd, current_offset);
-  if (current_offset == 0)
+
+  if (!som_flush_contents (abfd))
     return false;
+  som_free_contents (abfd);
   
-  current_offset = write_fixup_stream(abfd, current_offset);
-  if (current_offset == 0)
-    return false;
-  
-  if (!som_build_and_write_symbol_table(abfd))
-    return false;
-  
-  if (!write_all_subspaces(abfd, num_spaces))
-    return false;
-  
-  if (!write_space_dictionary(abfd, num_spaces))
-    return false;
-  
-  if (!write_compilation_unit(abfd))
-    return false;
-  
-  set_system_id(abfd);
-  
-  if (!write_file_header(abfd))
+  if (!som_layout_tail(abfd, &tail))
     return false;
+
+  /* Everything from here on goes into memory images of the metadata
+     in front of and behind the contents, each then written with a
+     single write.  */
+  ok = som_begin_output_images(abfd, sdata->head_end, sdata->contents_end,
+                               obj_som_file_hdr(abfd)->som_length);
+  
+  ok = (ok
+        && write_auxiliary_headers(abfd)
+        && write_string_table(abfd, sdata->space_strings)
+        && write_symbol_strings_section(abfd, tail.symbol_strings)
+        && write_fixup_stream(abfd, &tail.fixups));
+  som_free_tail_image(&tail);
+  
+  ok = (ok
+        && som_build_and_write_symbol_table(abfd)
+        && write_all_subspaces(abfd, num_spaces)
+        && write_space_dictionary(abfd, num_spaces)
+        && write_compilation_unit(abfd));
+  
+  if (ok)
+    {
+      set_system_id(abfd);
+      ok = (write_file_header(abfd)
+            && write_exec_header(abfd)
+            && som_flush_output_images(abfd));
+    }
   
-  return write_exec_header(abfd);
+  som_free_output_images(abfd);
+  free(sdata->space_strings);
+  sdata->space_strings = NULL;
+  return ok;
 }
 
-/* Compute and return the checksum for a SOM file header.  */
+/* Compute and return the checksum for a SOM file header.  This is the
+   XOR of the header's 32-bit words, which is the same whichever way
+   round the words are loaded; fold two at a time by loading them as
+   one 64-bit value.  */
 
 static uint32_t
 som_compute_checksum (struct som_external_header *hdr)
 {
-  size_t count, i;
-  uint32_t checksum;
-  uint32_t *buffer = (uint32_t *) hdr;
+  const unsigned char *p = (const unsigned char *) hdr;
+  size_t size = sizeof (*hdr);
+  uint64_t wide = 0;
+  uint32_t checksum = 0;
+  size_t i;
+
+  for (i = 0; i + sizeof (wide) <= size; i += sizeof (wide))
+    {
+      uint64_t w;
+
+      memcpy (&w, p + i, sizeof (w));
+      wide ^= w;
+    }
+  for (; i + sizeof (checksum) <= size; i += sizeof (checksum))
+    {
+      uint32_t w;
 
-  checksum = 0;
-  count = sizeof (*hdr) / sizeof (*buffer);
-  for (i = 0; i < count; i++)
-    checksum ^= buffer[i];
+      memcpy (&w, p + i, sizeof (w));
+      checksum ^= w;
+    }
 
-  return checksum;
+  return checksum ^ (uint32_t) wide ^ (uint32_t) (wide >> 32);
 }
 
 static bool is_function_symbol(asymbol *sym)
@@ -4763,26 +6087,6 @@ som_bfd_derive_misc_symbol_info (bfd *abfd ATTRIBUTE_UNUSED,
 /* Build and write, in one big chunk, the entire symbol table for
    this BFD.  */
 
-static bool
-allocate_symbol_table(unsigned int num_syms, struct som_external_symbol_dictionary_record **som_symtab)
-{
-  size_t amt;
-  
-  if (_bfd_mul_overflow(num_syms,
-                       sizeof(struct som_external_symbol_dictionary_record),
-                       &amt))
-    {
-      bfd_set_error(bfd_error_no_memory);
-      return false;
-    }
-    
-  *som_symtab = bfd_zmalloc(amt);
-  if (*som_symtab == NULL && num_syms != 0)
-    return false;
-    
-  return true;
-}
-
 static unsigned int
 build_symbol_flags(struct som_misc_symbol_info *info)
 {
@@ -4833,40 +6137,76 @@ populate_symbol_table(bfd *abfd, unsigned int num_syms,
 }
 
 static bool
-write_symbol_table(bfd *abfd, unsigned int num_syms,
-                  struct som_external_symbol_dictionary_record *som_symtab)
+som_build_and_write_symbol_table(bfd *abfd)
 {
-  file_ptr symtab_location = obj_som_file_hdr(abfd)->symbol_location;
-  bfd_size_type symtab_size;
+  unsigned int num_syms = bfd_get_symcount(abfd);
+  file_ptr location = obj_som_file_hdr(abfd)->symbol_location;
+  struct som_external_symbol_dictionary_record *som_symtab;
+  size_t amt;
   
-  if (bfd_seek(abfd, symtab_location, SEEK_SET) != 0)
-    return false;
-    
-  symtab_size = num_syms;
-  symtab_size *= sizeof(struct som_external_symbol_dictionary_record);
+  if (num_syms == 0)
+    return true;
+  if (_bfd_mul_overflow(num_syms, sizeof(*som_symtab), &amt))
+    {
+      bfd_set_error(bfd_error_no_memory);
+      return false;
+    }
   
-  if (bfd_write(som_symtab, symtab_size, abfd) != symtab_size)
+  /* Convert straight into the output image when there is one.  */
+  som_symtab = som_output_buffer(abfd, location, amt);
+  if (som_symtab == NULL)
     return false;
     
-  return true;
+  populate_symbol_table(abfd, num_syms, som_symtab);
+  
+  return som_output_done(abfd, location, som_symtab, amt, true);
 }
 
-static bool
-som_build_and_write_symbol_table(bfd *abfd)
+/* Work out the layout of the output file ABFD without writing
+   anything.  The location of every region is filled in to the file
+   header, as returned by obj_som_file_hdr, and *FILE_SIZE is set to
+   the size the file will have.  The sections, symbols and relocations
+   of ABFD must be final; their contents need not have been set.  */
+
+bool
+bfd_som_plan_layout (bfd *abfd, file_ptr *file_size)
 {
-  unsigned int num_syms = bfd_get_symcount(abfd);
-  struct som_external_symbol_dictionary_record *som_symtab = NULL;
-  bool result;
-  
-  if (!allocate_symbol_table(num_syms, &som_symtab))
+  struct som_tail_image tail;
+  unsigned long size, contents_end;
+
+  if (bfd_get_flavour (abfd) != bfd_target_som_flavour
+      || bfd_get_format (abfd) != bfd_object
+      || bfd_write_p (abfd) == 0)
+    {
+      bfd_set_error (bfd_error_invalid_operation);
+      return false;
+    }
+
+  if (!abfd->output_has_begun)
+    {
+      char *strings;
+
+      if (!som_prep_headers (abfd)
+	  || !som_layout_head (abfd, &strings))
+	return false;
+      free (strings);
+    }
+
+  if (!som_layout_tail (abfd, &tail))
     return false;
-    
-  populate_symbol_table(abfd, num_syms, som_symtab);
-  
-  result = write_symbol_table(abfd, num_syms, som_symtab);
-  
-  free(som_symtab);
-  return result;
+  som_free_tail_image (&tail);
+
+  /* finalize_file extends the file to the end of the (page aligned,
+     for executables) contents area, which may lie past the end of the
+     symbol table and fixups.  */
+  size = obj_som_file_hdr (abfd)->som_length;
+  contents_end = som_private_data (abfd)->contents_end;
+  if (abfd->flags & (EXEC_P | DYNAMIC))
+    contents_end = SOM_ALIGN (contents_end, PA_PAGESIZE);
+  if (contents_end > size)
+    size = contents_end;
+  *file_size = size;
+  return true;
 }
 
 /* Write an object in SOM format.  */
@@ -4876,12 +6216,17 @@ som_write_object_contents (bfd *abfd)
 {
   if (!abfd->output_has_begun)
     {
-      som_prep_headers (abfd);
+      if (!som_prep_headers (abfd))
+	return false;
       abfd->output_has_begun = true;
-      som_begin_writing (abfd);
+      if (!som_begin_writing (abfd))
+	return false;
     }
 
-  return som_finish_writing (abfd);
+  SOM_STAT_TIMER_START (start);
+  bool ok = som_finish_writing (abfd);
+  SOM_STAT_TIMER_STOP (abfd, finish_writing_time, start);
+  return ok;
 }
 
 /* Read and save the string table associated with the given BFD.  */
@@ -4904,12 +6249,26 @@ som_slurp_string_table (bfd *abfd)
   if (bfd_seek (abfd, obj_som_str_filepos (abfd), SEEK_SET) != 0)
     return false;
     
+  /* The string table lives as long as the BFD, so map it in place.
+     Symbol names point straight into it.  */
   amt = obj_som_stringtab_size (abfd);
-  stringtab = (char *) _bfd_malloc_and_read (abfd, amt + 1, amt);
+  stringtab = (char *) _bfd_mmap_readonly_persistent (abfd, amt);
   if (stringtab == NULL)
     return false;
-    
-  stringtab[amt] = 0;
+
+  /* Names are looked up with plain string functions, so make sure the
+     table is terminated.  A well-formed table always is.  */
+  if (stringtab[amt - 1] != 0)
+    {
+      char *copy = (char *) bfd_alloc (abfd, amt + 1);
+
+      if (copy == NULL)
+	return false;
+      memcpy (copy, stringtab, amt);
+      copy[amt] = 0;
+      stringtab = copy;
+    }
+
   obj_som_stringtab (abfd) = stringtab;
   return true;
 }
@@ -4962,17 +6321,64 @@ is_function_symbol(unsigned int symbol_type)
 static asection *
 find_section_by_index(bfd *abfd, struct som_external_symbol_dictionary_record *symbol)
 {
+  struct som_private_data *sdata = som_private_data (abfd);
   int idx = (bfd_getb32 (symbol->info) >> SOM_SYMBOL_SYMBOL_INFO_SH) 
     & SOM_SYMBOL_SYMBOL_INFO_MASK;
     
+  if (sdata->subspace_by_index != NULL)
+    {
+      if (idx >= 0 && (unsigned int) idx < sdata->subspace_count)
+        return sdata->subspace_by_index[idx];
+      return bfd_abs_section_ptr;
+    }
+    
   return find_matching_subspace(abfd, section_matches_index, &idx);
 }
 
+/* Return the subspace containing VALUE using the sorted range table.
+   Where subspaces overlap this picks the same one as a walk of the
+   section list would: the earliest one in the list.  */
+
+static asection *
+find_subspace_range (struct som_private_data *sdata, bfd_vma value)
+{
+  struct som_subspace_range *ranges = sdata->subspace_ranges;
+  unsigned int lo = 0, hi = sdata->subspace_count;
+  asection *found = bfd_abs_section_ptr;
+  unsigned int found_pos = (unsigned int) -1;
+
+  /* Find the first entry starting after VALUE.  */
+  while (lo < hi)
+    {
+      unsigned int mid = lo + (hi - lo) / 2;
+
+      if (ranges[mid].vma <= value)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+
+  /* Every entry before it starts at or below VALUE; walk back while
+     one of them could still reach VALUE.  */
+  while (lo-- > 0 && ranges[lo].max_end >= value)
+    if (ranges[lo].end >= value && ranges[lo].list_pos < found_pos)
+      {
+        found = ranges[lo].section;
+        found_pos = ranges[lo].list_pos;
+      }
+
+  return found;
+}
+
 static asection *
 find_section_by_address(bfd *abfd, struct som_external_symbol_dictionary_record *symbol)
 {
+  struct som_private_data *sdata = som_private_data (abfd);
   unsigned int value = bfd_getb32 (symbol->symbol_value);
   
+  if (sdata->subspace_ranges != NULL)
+    return find_subspace_range (sdata, value);
+    
   return find_matching_subspace(abfd, section_contains_address, &value);
 }
 
@@ -5005,107 +6411,216 @@ section_contains_address(asection *section, void *data)
       && *value <= section->vma + section->size;
 }
 
-/* Read and save the symbol table associated with the given BFD.  */
+/* Get ready to decode the symbols of ABFD on demand: read the string
+   table and raw symbol dictionary, count the canonical symbols and
+   allocate room for them.  Nothing is decoded yet.  */
 
-static unsigned int
-som_slurp_symbol_table (bfd *abfd)
+static bool
+som_prepare_symbols (bfd *abfd)
 {
-  unsigned int symbol_count = bfd_get_symcount (abfd);
+  struct som_private_data *sdata = som_private_data (abfd);
+  unsigned int symbol_count;
   size_t symsize = sizeof (struct som_external_symbol_dictionary_record);
-  struct som_external_symbol_dictionary_record *buf = NULL;
-  som_symbol_type *symbase = NULL;
+  unsigned int *dict_index = NULL;
+  unsigned int i, count;
   size_t amt;
 
-  if (obj_som_symtab (abfd) != NULL)
-    goto successful_return;
+  if (sdata->lazy_symtab != NULL)
+    return true;
 
-  if (symbol_count == 0)
-    goto successful_return;
+  if (sdata->sym_dict_count == 0)
+    sdata->sym_dict_count = bfd_get_symcount (abfd);
+  symbol_count = sdata->sym_dict_count;
 
   if (!som_slurp_string_table (abfd))
-    goto error_return;
+    return false;
 
-  if (!allocate_symbol_buffers (abfd, symbol_count, symsize, &buf, &symbase, &amt))
-    goto error_return;
+  /* The raw dictionary is only needed until every symbol has been
+     decoded, so map it temporarily rather than copying it.  */
+  sdata->raw_syms = (struct som_external_symbol_dictionary_record *)
+    som_read_records_temporary (abfd, obj_som_sym_filepos (abfd),
+				symbol_count, symsize, &sdata->raw_syms_map,
+				&sdata->raw_syms_map_size);
+  if (sdata->raw_syms == NULL)
+    return false;
 
-  if (!process_symbols (abfd, buf, symbase, symbol_count))
-    goto error_return;
+  /* Symbol extension records are not symbols in their own right.
+     Only look at the flags word here; that is much cheaper than
+     decoding.  */
+  for (i = 0, count = 0; i < symbol_count; i++)
+    {
+      unsigned int flags = bfd_getb32 (sdata->raw_syms[i].flags);
 
-  obj_som_symtab (abfd) = symbase;
+      if (should_skip_symbol (extract_symbol_type (flags)))
+	continue;
 
- successful_return:
-  free (buf);
+      if (count != i && dict_index == NULL)
+	{
+	  unsigned int j;
+
+	  if (_bfd_mul_overflow (symbol_count, sizeof (unsigned int), &amt))
+	    {
+	      bfd_set_error (bfd_error_file_too_big);
+	      goto error_return;
+	    }
+	  dict_index = bfd_malloc (amt);
+	  if (dict_index == NULL)
+	    goto error_return;
+	  for (j = 0; j < count; j++)
+	    dict_index[j] = j;
+	}
+      if (dict_index != NULL)
+	dict_index[count] = i;
+      count++;
+    }
+
+  if (_bfd_mul_overflow (count, sizeof (som_symbol_type), &amt))
+    {
+      bfd_set_error (bfd_error_file_too_big);
+      goto error_return;
+    }
+
+  sdata->lazy_symtab = bfd_zmalloc (amt);
+  if (sdata->lazy_symtab == NULL)
+    goto error_return;
+
+  sdata->sym_dict_index = dict_index;
+  abfd->symcount = count;
   return true;
 
  error_return:
-  free (symbase);
-  free (buf);
+  free (dict_index);
+  _bfd_munmap_readonly_temporary (sdata->raw_syms_map,
+				  sdata->raw_syms_map_size);
+  sdata->raw_syms = NULL;
+  sdata->raw_syms_map = NULL;
+  sdata->raw_syms_map_size = 0;
   return false;
 }
 
+/* Release the raw symbol dictionary of ABFD.  */
+
+static void
+som_release_raw_symbols (bfd *abfd)
+{
+  struct som_private_data *sdata = som_private_data (abfd);
+
+  _bfd_munmap_readonly_temporary (sdata->raw_syms_map,
+				  sdata->raw_syms_map_size);
+  sdata->raw_syms = NULL;
+  sdata->raw_syms_map = NULL;
+  sdata->raw_syms_map_size = 0;
+  free (sdata->sym_dict_index);
+  sdata->sym_dict_index = NULL;
+}
+
+/* Decode the dictionary record BUFP into the canonical symbol SYM.  */
+
 static bool
-allocate_symbol_buffers (bfd *abfd, unsigned int symbol_count, size_t symsize,
-                         struct som_external_symbol_dictionary_record **buf,
-                         som_symbol_type **symbase, size_t *amt)
+som_decode_symbol (bfd *abfd,
+		   struct som_external_symbol_dictionary_record *bufp,
+		   som_symbol_type *sym)
 {
-  if (_bfd_mul_overflow (symbol_count, symsize, amt))
-    {
-      bfd_set_error (bfd_error_file_too_big);
-      return false;
-    }
+  unsigned int flags = bfd_getb32 (bufp->flags);
+  unsigned int symbol_type = extract_symbol_type (flags);
+  unsigned int symbol_scope = extract_symbol_scope (flags);
 
-  if (bfd_seek (abfd, obj_som_sym_filepos (abfd), SEEK_SET) != 0)
+  if (!initialize_symbol (abfd, sym, bufp, flags, obj_som_stringtab (abfd)))
     return false;
 
-  *buf = (struct som_external_symbol_dictionary_record *)
-    _bfd_malloc_and_read (abfd, *amt, *amt);
-  if (*buf == NULL)
-    return false;
+  set_som_type (sym, symbol_type);
+  process_symbol_type (sym, symbol_type, symbol_scope);
+  process_symbol_scope (abfd, sym, bufp, symbol_type, symbol_scope);
+  process_symbol_flags (sym, flags);
+  return true;
+}
+
+/* Return canonical symbol INDEX of ABFD, decoding it if need be.  */
+
+static som_symbol_type *
+som_get_lazy_symbol (bfd *abfd, unsigned int index)
+{
+  struct som_private_data *sdata = som_private_data (abfd);
+  som_symbol_type *sym = &sdata->lazy_symtab[index];
 
-  if (_bfd_mul_overflow (symbol_count, sizeof (som_symbol_type), amt))
+  if (sym->symbol.the_bfd == NULL)
     {
-      bfd_set_error (bfd_error_file_too_big);
-      return false;
+      unsigned int dict_index = index;
+
+      if (sdata->sym_dict_index != NULL)
+	dict_index = sdata->sym_dict_index[index];
+      if (!som_decode_symbol (abfd, &sdata->raw_syms[dict_index], sym))
+	{
+	  sym->symbol.the_bfd = NULL;
+	  return NULL;
+	}
+      SOM_STAT_ADD (abfd, symbols_decoded, 1);
     }
+  return sym;
+}
+
+/* Read and save the symbol table associated with the given BFD.  This
+   is the eager path: every symbol not yet decoded by bfd_som_get_symbol
+   is decoded now.  */
+
+static unsigned int
+som_slurp_symbol_table (bfd *abfd)
+{
+  struct som_private_data *sdata = som_private_data (abfd);
+  unsigned int i;
+
+  if (obj_som_symtab (abfd) != NULL)
+    return true;
 
-  *symbase = bfd_zmalloc (*amt);
-  if (*symbase == NULL)
+  if (bfd_get_symcount (abfd) == 0)
+    return true;
+
+  if (!som_prepare_symbols (abfd))
     return false;
 
+  for (i = 0; i < bfd_get_symcount (abfd); i++)
+    if (som_get_lazy_symbol (abfd, i) == NULL)
+      return false;
+
+  obj_som_symtab (abfd) = sdata->lazy_symtab;
+  som_release_raw_symbols (abfd);
   return true;
 }
 
-static bool
-process_symbols (bfd *abfd, struct som_external_symbol_dictionary_record *buf,
-                som_symbol_type *symbase, unsigned int symbol_count)
+/* Return symbol INDEX of ABFD, as it would be numbered by
+   bfd_canonicalize_symtab, without decoding the rest of the symbol
+   table.  The symbol lives as long as the BFD's cached symbol
+   information, and is the same object bfd_canonicalize_symtab later
+   returns.  */
+
+asymbol *
+bfd_som_get_symbol (bfd *abfd, unsigned int index)
 {
-  struct som_external_symbol_dictionary_record *bufp, *endbufp;
   som_symbol_type *sym;
-  char *stringtab = obj_som_stringtab (abfd);
 
-  endbufp = buf + symbol_count;
-  for (bufp = buf, sym = symbase; bufp < endbufp; ++bufp)
+  if (bfd_get_flavour (abfd) != bfd_target_som_flavour
+      || bfd_get_format (abfd) != bfd_object)
     {
-      unsigned int flags = bfd_getb32 (bufp->flags);
-      unsigned int symbol_type = extract_symbol_type (flags);
-      unsigned int symbol_scope = extract_symbol_scope (flags);
-
-      if (should_skip_symbol (symbol_type))
-        continue;
-
-      if (!initialize_symbol (abfd, sym, bufp, flags, stringtab))
-        return false;
+      bfd_set_error (bfd_error_invalid_operation);
+      return NULL;
+    }
 
-      set_som_type (sym, symbol_type);
-      process_symbol_type (sym, symbol_type, symbol_scope);
-      process_symbol_scope (abfd, sym, bufp, symbol_type, symbol_scope);
-      process_symbol_flags (sym, flags);
+  if (obj_som_symtab (abfd) == NULL
+      && bfd_get_symcount (abfd) != 0
+      && !som_prepare_symbols (abfd))
+    return NULL;
 
-      sym++;
+  if (index >= bfd_get_symcount (abfd))
+    {
+      bfd_set_error (bfd_error_bad_value);
+      return NULL;
     }
 
-  abfd->symcount = sym - symbase;
-  return true;
+  if (obj_som_symtab (abfd) != NULL)
+    return &obj_som_symtab (abfd)[index].symbol;
+
+  sym = som_get_lazy_symbol (abfd, index);
+  return sym != NULL ? &sym->symbol : NULL;
 }
 
 static unsigned int
@@ -5114,6 +6629,153 @@ extract_symbol_type (unsigned int flags)
   return (flags >> SOM_SYMBOL_TYPE_SH) & SOM_SYMBOL_TYPE_MASK;
 }
 
+/* Build the name index used by bfd_som_lookup_symbol over the names
+   symbols have once decoded.  Those mostly come straight from the
+   string table, so only the section symbols that decoding renames
+   need be decoded.  */
+
+static bool
+som_build_symbol_hash (bfd *abfd)
+{
+  struct som_private_data *sdata = som_private_data (abfd);
+  unsigned int count, nbuckets, i;
+  unsigned int *buckets;
+  struct som_symbol_hash_entry *chain;
+  size_t amt;
+
+  if (obj_som_symtab (abfd) == NULL && !som_prepare_symbols (abfd))
+    return false;
+
+  count = bfd_get_symcount (abfd);
+  for (nbuckets = 1; nbuckets < count && nbuckets < 0x80000000; nbuckets <<= 1)
+    ;
+
+  if (_bfd_mul_overflow (nbuckets, sizeof (*buckets), &amt))
+    {
+      bfd_set_error (bfd_error_file_too_big);
+      return false;
+    }
+  buckets = bfd_malloc (amt);
+  if (buckets == NULL)
+    return false;
+  memset (buckets, 0xff, amt);
+
+  if (_bfd_mul_overflow (count, sizeof (*chain), &amt))
+    {
+      bfd_set_error (bfd_error_file_too_big);
+      free (buckets);
+      return false;
+    }
+  chain = bfd_malloc (amt);
+  if (chain == NULL)
+    {
+      free (buckets);
+      return false;
+    }
+
+  /* Insert from the end so that each chain lists symbols in symbol
+     table order.  */
+  for (i = count; i-- > 0; )
+    {
+      const char *name;
+
+      if (obj_som_symtab (abfd) != NULL)
+	name = obj_som_symtab (abfd)[i].symbol.name;
+      else
+	{
+	  unsigned int dict_index = i;
+	  bfd_vma offset;
+
+	  if (sdata->sym_dict_index != NULL)
+	    dict_index = sdata->sym_dict_index[i];
+	  offset = bfd_getb32 (sdata->raw_syms[dict_index].name);
+	  /* Leave bad names for som_decode_symbol to complain about.  */
+	  if (offset >= obj_som_stringtab_size (abfd))
+	    {
+	      chain[i].hash = 0;
+	      chain[i].next = (unsigned int) -1;
+	      continue;
+	    }
+	  name = obj_som_stringtab (abfd) + offset;
+
+	  /* Decoding renames these to their section; hash the name a
+	     decoded symbol ends up with.  */
+	  if (startswith (name, "L$0\002"))
+	    {
+	      som_symbol_type *sym = som_get_lazy_symbol (abfd, i);
+
+	      if (sym == NULL)
+		{
+		  free (buckets);
+		  free (chain);
+		  return false;
+		}
+	      name = sym->symbol.name;
+	    }
+	}
+
+      chain[i].hash = htab_hash_string (name);
+      chain[i].next = buckets[chain[i].hash & (nbuckets - 1)];
+      buckets[chain[i].hash & (nbuckets - 1)] = i;
+    }
+
+  sdata->sym_hash_buckets = buckets;
+  sdata->sym_hash_chain = chain;
+  sdata->sym_hash_mask = nbuckets - 1;
+  return true;
+}
+
+/* Return the symbol of ABFD called NAME, preferring a definition over
+   an undefined reference if there are several.  Return NULL if there
+   is none, or on error with the BFD error set.  Only the symbols
+   looked at are decoded; see bfd_som_get_symbol.  */
+
+asymbol *
+bfd_som_lookup_symbol (bfd *abfd, const char *name)
+{
+  struct som_private_data *sdata;
+  asymbol *undef = NULL;
+  unsigned int hash, i;
+
+  if (bfd_get_flavour (abfd) != bfd_target_som_flavour
+      || bfd_get_format (abfd) != bfd_object)
+    {
+      bfd_set_error (bfd_error_invalid_operation);
+      return NULL;
+    }
+
+  if (bfd_get_symcount (abfd) == 0)
+    return NULL;
+
+  sdata = som_private_data (abfd);
+  if (sdata->sym_hash_buckets == NULL && !som_build_symbol_hash (abfd))
+    return NULL;
+
+  hash = htab_hash_string (name);
+  for (i = sdata->sym_hash_buckets[hash & sdata->sym_hash_mask];
+       i != (unsigned int) -1;
+       i = sdata->sym_hash_chain[i].next)
+    {
+      asymbol *sym;
+
+      if (sdata->sym_hash_chain[i].hash != hash)
+	continue;
+
+      sym = bfd_som_get_symbol (abfd, i);
+      if (sym == NULL)
+	return NULL;
+      /* Decoding may rename a symbol, so check the final name.  */
+      if (strcmp (sym->name, name) != 0)
+	continue;
+      if (!bfd_is_und_section (sym->section))
+	return sym;
+      if (undef == NULL)
+	undef = sym;
+    }
+
+  return undef;
+}
+
 static unsigned int
 extract_symbol_scope (unsigned int flags)
 {
@@ -5292,6 +6954,12 @@ som_canonicalize_symtab (bfd *abfd, asymbol **location)
   if (!som_slurp_symbol_table (abfd))
     return -1;
 
+  /* The caller gets a new symbol table; an address index built from
+     the last one may no longer match it.  */
+  free (som_private_data (abfd)->func_index);
+  som_private_data (abfd)->func_index = NULL;
+  som_private_data (abfd)->func_index_count = 0;
+
   int symbol_count = bfd_get_symcount (abfd);
   som_symbol_type *symbase = obj_som_symtab (abfd);
 
@@ -5358,6 +7026,38 @@ som_bfd_is_local_label_name (bfd *abfd ATTRIBUTE_UNUSED,
   return name[0] == LOCAL_LABEL_PREFIX && name[1] == LOCAL_LABEL_SUFFIX;
 }
 
+/* Make room for at least one more relocation after the first COUNT
+   entries of the malloc'd array *RELOCSP, which currently holds
+   *CAPACITYP entries.  Return a pointer to entry COUNT, or NULL on
+   failure (the old array is left for the caller to free).  */
+
+static arelent *
+grow_internal_relocs (arelent **relocsp, unsigned int *capacityp,
+		      unsigned int count)
+{
+  unsigned int new_capacity;
+  arelent *relocs;
+  size_t amt;
+
+  new_capacity = *capacityp != 0 ? *capacityp * 2 : 64;
+  if (new_capacity <= *capacityp
+      || _bfd_mul_overflow (new_capacity, sizeof (arelent), &amt))
+    {
+      bfd_set_error (bfd_error_file_too_big);
+      return NULL;
+    }
+
+  relocs = bfd_realloc (*relocsp, amt);
+  if (relocs == NULL)
+    return NULL;
+
+  memset (relocs + *capacityp, 0,
+	  (new_capacity - *capacityp) * sizeof (arelent));
+  *relocsp = relocs;
+  *capacityp = new_capacity;
+  return relocs + count;
+}
+
 /* Count or process variable-length SOM fixup records.
 
    To avoid code duplication we use this code both to compute the number
@@ -5366,15 +7066,22 @@ som_bfd_is_local_label_name (bfd *abfd ATTRIBUTE_UNUSED,
    When computing the number of relocations requested by a stream the
    variables rptr, section, and symbols have no meaning.
 
-   Return the number of relocations requested by the fixup stream.  When
-   not just counting
+   When not just counting the relocations are stored in *INTERNAL_RELOCSP.
+   If CAPACITYP is NULL that array must already be big enough.  Otherwise
+   it is a malloc'd array of *CAPACITYP entries (possibly NULL and zero)
+   which is grown as needed, letting the stream be internalized in a
+   single pass without counting it first.
+
+   Return the number of relocations requested by the fixup stream, or
+   -1 if growing the array failed.
 
    This needs at least two or three more passes to get it cleaned up.  */
 
 static unsigned int
 som_set_reloc_info (unsigned char *fixup,
 		    unsigned int end,
-		    arelent *internal_relocs,
+		    arelent **internal_relocsp,
+		    unsigned int *capacityp,
 		    asection *section,
 		    asymbol **symbols,
 		    unsigned int symcount,
@@ -5383,8 +7090,9 @@ som_set_reloc_info (unsigned char *fixup,
   unsigned int deallocate_contents = 0;
   unsigned char *end_fixups = &fixup[end];
   int variables[26], stack[20], count, prev_fixup, *sp, saved_unwind_bits;
-  arelent *rptr = internal_relocs;
+  arelent *rptr = internal_relocsp != NULL ? *internal_relocsp : NULL;
   unsigned int offset = 0;
+  struct reloc_queue reloc_queue[QUEUE_SIZE];
 
 #define	var(c)		variables[(c) - 'A']
 #define	push(v)		(*sp++ = (v))
@@ -5419,16 +7127,30 @@ som_set_reloc_info (unsigned char *fixup,
 	  fp = &som_fixup_formats[op];
 	}
 
+      if (!just_count && capacityp != NULL && (unsigned) count >= *capacityp)
+	{
+	  rptr = grow_internal_relocs (internal_relocsp, capacityp, count);
+	  if (rptr == NULL)
+	    return (unsigned) -1;
+	}
+
       if (!just_count)
-	initialize_relocation(rptr, op, offset);
+	{
+	  initialize_relocation(rptr, op, offset);
+	  SOM_STAT_ADD (section->owner,
+			fixups_decoded[som_hppa_howto_table[op].type & 0xff], 1);
+	}
 
       var ('L') = 0;
       var ('D') = fp->D;
       var ('U') = saved_unwind_bits;
 
-      process_format_string(fp->format, fixup, end_fixups, variables, 
-                           stack, &sp, rptr, op, symbols, symcount,
-                           just_count, &offset, &saved_unwind_bits);
+      if (!som_decode_fixup_fast (op, fp, &fixup, end_fixups, variables,
+				  rptr, symbols, symcount, just_count,
+				  &offset, &saved_unwind_bits))
+	process_format_string(fp->format, &fixup, end_fixups, variables, 
+			      stack, &sp, rptr, op, symbols, symcount,
+			      just_count, &offset, &saved_unwind_bits);
 
       if (prev_fixup)
 	{
@@ -5481,7 +7203,7 @@ static bool should_process_relocation(unsigned int op)
          && som_hppa_howto_table[op].type != R_NO_RELOCATION;
 }
 
-static void process_format_string(const char *format, unsigned char *&fixup,
+static void process_format_string(const char *format, unsigned char **fixup,
                                  unsigned char *end_fixups, int *variables,
                                  int *stack, int **sp, arelent *rptr,
                                  unsigned int op, asymbol **symbols,
@@ -5500,7 +7222,7 @@ static void process_format_string(const char *format, unsigned char *&fixup,
     }
 }
 
-static int compute_rhs_value(const char **cp, unsigned char *&fixup,
+static int compute_rhs_value(const char **cp, unsigned char **fixup,
                             unsigned char *end_fixups, int *variables,
                             int *stack, int **sp, unsigned int varname)
 {
@@ -5511,7 +7233,7 @@ static int compute_rhs_value(const char **cp, unsigned char *&fixup,
       if (ISUPPER (c))
         push_stack(sp, variables[c - 'A']);
       else if (ISLOWER (c))
-        push_stack(sp, read_fixup_data(&fixup, end_fixups, c, varname));
+        push_stack(sp, read_fixup_data(fixup, end_fixups, c, varname));
       else if (ISDIGIT (c))
         push_stack(sp, read_decimal(cp, c));
       else
@@ -5548,19 +7270,95 @@ static int read_fixup_data(unsigned char **fixup, unsigned char *end_fixups,
   return v;
 }
 
-static int read_decimal(const char **cp, int c)
-{
-  int v = c - '0';
-  while (ISDIGIT (**cp))
-    v = (v * 10) + (*(*cp)++ - '0');
-  return v;
-}
+/* Decode the most common fixups directly instead of interpreting
+   their format strings: the R_NO_RELOCATION skips, R_DATA_ONE_SYMBOL,
+   R_CODE_ONE_SYMBOL, R_ENTRY and R_EXIT.  The effect on VARIABLES,
+   *OFFSET, *SAVED_UNWIND_BITS and RPTR is exactly that of running
+   process_format_string on FP->format.  Return false if OP is not one
+   of these and must go through the interpreter.  */
 
-static void process_operator(int c, int **sp)
+static bool
+som_decode_fixup_fast (unsigned int op, const struct fixup_format *fp,
+		       unsigned char **fixup, unsigned char *end_fixups,
+		       int *variables, arelent *rptr, asymbol **symbols,
+		       unsigned int symcount, bool just_count,
+		       unsigned int *offset, int *saved_unwind_bits)
 {
-  int v = pop_stack(sp);
-  int v2 = pop_stack(sp);
-  
+  int value;
+
+#define	var(c)		variables[(c) - 'A']
+#define	get(n)		read_fixup_data (fixup, end_fixups, 'a' + (n), 0)
+
+  if (op < R_NO_RELOCATION + 0x18)
+    /* "LD1+4*=" */
+    value = (fp->D + 1) * 4;
+  else if (op < R_NO_RELOCATION + 0x1c)
+    /* "LD8<b+1+4*=" */
+    value = ((fp->D << 8) + get (1) + 1) * 4;
+  else if (op < R_NO_RELOCATION + 0x1f)
+    /* "LD16<c+1+4*=" */
+    value = ((fp->D << 16) + get (2) + 1) * 4;
+  else if (op == R_NO_RELOCATION + 0x1f)
+    /* "Ld1+=" */
+    value = get (3) + 1;
+  else if ((op >= R_CODE_ONE_SYMBOL && op < R_CODE_ONE_SYMBOL + 0x20)
+	   || op == R_DATA_ONE_SYMBOL || op == R_DATA_ONE_SYMBOL + 1
+	   || op == R_CODE_ONE_SYMBOL + 0x20 || op == R_CODE_ONE_SYMBOL + 0x21)
+    {
+      /* "L4=SD=", "L4=Sb=" or "L4=Sd=".  */
+      var ('L') = 4;
+      *offset += 4;
+      if (op < R_CODE_ONE_SYMBOL + 0x20 && op >= R_CODE_ONE_SYMBOL)
+	value = fp->D;
+      else
+	value = get (fp->D == 0 || fp->D == 32 ? 1 : 3);
+      var ('S') = value;
+      handle_symbol_assignment (rptr, symbols, symcount, value, just_count);
+      return true;
+    }
+  else if (op == R_ENTRY)
+    {
+      /* "Te=Ue=" */
+      var ('T') = get (4);
+      var ('U') = get (4);
+      *saved_unwind_bits = var ('U');
+      return true;
+    }
+  else if (op == R_ENTRY + 1)
+    {
+      /* "Uf=" */
+      var ('U') = get (5);
+      *saved_unwind_bits = var ('U');
+      return true;
+    }
+  else if (op == R_EXIT)
+    /* "" */
+    return true;
+  else
+    return false;
+
+  /* The R_NO_RELOCATION forms only set L.  */
+  var ('L') = value;
+  *offset += value;
+  return true;
+
+#undef var
+#undef get
+}
+
+static int read_decimal(const char **cp, int c)
+{
+  int v = c - '0';
+  while (ISDIGIT (**cp))
+    v = (v * 10) + (*(*cp)++ - '0');
+  return v;
+}
+
+static void process_operator(int c, int **sp)
+{
+  int v = pop_stack(sp);
+  int v2 = pop_stack(sp);
+  
   switch (c)
     {
     case '+':
@@ -5724,57 +7522,59 @@ static void handle_data_one_symbol(arelent *rptr, int *variables,
   
   if (rptr->addend == 0 && (section->flags & SEC_HAS_CONTENTS) != 0)
     {
-      if (!section->contents)
-        {
-          if (!load_section_contents(section))
-            return;
-        }
-        
       int var_l = variables['L' - 'A'];
-      if (offset - var_l <= section->size
-          && section->size - (offset - var_l) >= 4)
-        rptr->addend = bfd_get_32 (section->owner,
-                                  (section->contents + offset - var_l));
-    }
-}
+      bfd_byte buf[4];
 
-static bool load_section_contents(asection *section)
-{
-  bfd_byte *contents;
-  if (!bfd_malloc_and_get_section (section->owner, section, &contents))
-    {
-      free (contents);
-      return false;
+      if (offset - var_l > section->size
+          || section->size - (offset - var_l) < 4)
+        return;
+
+      /* Only the four bytes of the addend are needed; unless the
+         contents are already in memory, get them through the page
+         cache rather than reading the whole section.  */
+      if (section->contents != NULL)
+        rptr->addend = bfd_get_32 (section->owner,
+                                   section->contents + offset - var_l);
+      else if (som_get_section_contents (section->owner, section, buf,
+                                         offset - var_l, 4))
+        rptr->addend = bfd_get_32 (section->owner, buf);
     }
-  section->contents = contents;
-  return true;
 }
 
-/* Read in the relocs (aka fixups in SOM terms) for a section.
-
-   som_get_reloc_upper_bound calls this routine with JUST_COUNT
-   set to TRUE to indicate it only needs a count of the number
-   of actual relocations.  */
+/* Read in the raw relocs (aka fixups in SOM terms) for a section.  */
 
 static bool
 read_external_relocs(bfd *abfd, asection *section, unsigned int fixup_stream_size)
 {
-    size_t amt = fixup_stream_size;
+    struct som_private_section_data *sdata = som_private_section_data(section);
     unsigned char *external_relocs;
     
-    if (bfd_seek(abfd, obj_som_reloc_filepos(abfd) + section->rel_filepos, SEEK_SET) != 0)
-        return false;
-    
-    external_relocs = _bfd_malloc_and_read(abfd, amt, amt);
+    external_relocs = som_read_temporary(abfd,
+                                         obj_som_reloc_filepos(abfd) + section->rel_filepos,
+                                         fixup_stream_size,
+                                         &sdata->reloc_stream_map,
+                                         &sdata->reloc_stream_map_size);
     if (external_relocs == NULL)
         return false;
     
-    section->reloc_count = som_set_reloc_info(external_relocs, fixup_stream_size,
-                                             NULL, NULL, NULL, 0, true);
-    som_section_data(section)->reloc_stream = external_relocs;
+    sdata->root.reloc_stream = external_relocs;
     return true;
 }
 
+/* Release the raw fixup stream read by read_external_relocs.  */
+
+static void
+release_external_relocs(asection *section)
+{
+    struct som_private_section_data *sdata = som_private_section_data(section);
+    
+    _bfd_munmap_readonly_temporary(sdata->reloc_stream_map,
+                                   sdata->reloc_stream_map_size);
+    sdata->reloc_stream_map = NULL;
+    sdata->reloc_stream_map_size = 0;
+    sdata->root.reloc_stream = NULL;
+}
+
 static bool
 allocate_internal_relocs(bfd *abfd, unsigned int num_relocs, arelent **internal_relocs)
 {
@@ -5795,14 +7595,52 @@ process_and_save_relocs(asection *section, unsigned char *external_relocs,
                        unsigned int fixup_stream_size, arelent *internal_relocs,
                        asymbol **symbols, bfd *abfd)
 {
-    som_set_reloc_info(external_relocs, fixup_stream_size, internal_relocs,
-                      section, symbols, bfd_get_symcount(abfd), false);
+    som_set_reloc_info(external_relocs, fixup_stream_size, &internal_relocs,
+                      NULL, section, symbols, bfd_get_symcount(abfd), false);
     
-    free(external_relocs);
-    som_section_data(section)->reloc_stream = NULL;
+    release_external_relocs(section);
     section->relocation = internal_relocs;
 }
 
+/* Internalize the fixup stream EXTERNAL_RELOCS for SECTION in a single
+   pass, growing a temporary array as relocations are found and then
+   moving it into the BFD's memory at its final size.  */
+
+static bool
+decode_external_relocs(bfd *abfd, asection *section, unsigned char *external_relocs,
+                       unsigned int fixup_stream_size, asymbol **symbols)
+{
+    arelent *relocs = NULL;
+    arelent *internal_relocs;
+    unsigned int capacity = 0;
+    unsigned int num_relocs;
+    
+    num_relocs = som_set_reloc_info(external_relocs, fixup_stream_size, &relocs,
+                                    &capacity, section, symbols,
+                                    bfd_get_symcount(abfd), false);
+    if (num_relocs == (unsigned) -1
+        || !allocate_internal_relocs(abfd, num_relocs, &internal_relocs))
+    {
+        free(relocs);
+        release_external_relocs(section);
+        return false;
+    }
+    
+    if (num_relocs != 0)
+        memcpy(internal_relocs, relocs, num_relocs * sizeof(arelent));
+    free(relocs);
+    
+    release_external_relocs(section);
+    section->reloc_count = num_relocs;
+    section->relocation = internal_relocs;
+    return true;
+}
+
+/* Read in the relocs for SECTION.  som_get_reloc_upper_bound calls
+   this routine with JUST_COUNT set to TRUE to indicate it only needs a
+   count of the number of actual relocations; the count is kept in
+   reloc_count along with the raw stream for a later full read.  */
+
 static bool
 som_slurp_reloc_table(bfd *abfd, asection *section, asymbol **symbols, bool just_count)
 {
@@ -5822,6 +7660,14 @@ som_slurp_reloc_table(bfd *abfd, asection *section, asymbol **symbols, bool just
     {
         if (!read_external_relocs(abfd, section, fixup_stream_size))
             return false;
+        
+        external_relocs = som_section_data(section)->reloc_stream;
+        if (!just_count)
+            return decode_external_relocs(abfd, section, external_relocs,
+                                          fixup_stream_size, symbols);
+        
+        section->reloc_count = som_set_reloc_info(external_relocs, fixup_stream_size,
+                                                 NULL, NULL, NULL, NULL, 0, true);
     }
     
     if (just_count)
@@ -5884,6 +7730,91 @@ som_canonicalize_reloc (bfd *abfd,
   return section->reloc_count;
 }
 
+/* Return true if SECTION's fixup stream has not been read yet.  */
+
+static bool
+som_reloc_stream_unread (asection *section)
+{
+  return ((section->flags & SEC_RELOC) != 0
+	  && section->reloc_count == (unsigned) -1
+	  && som_section_data (section)->reloc_size != 0);
+}
+
+/* Read and internalize the relocations for every subspace of ABFD,
+   using SYMBOLS as the canonical symbol table.  The fixup streams for
+   all subspaces are contiguous in the file, so rather than reading each
+   one as bfd_canonicalize_reloc asks for it, read the whole fixup area
+   once and decode each subspace's stream from it.  Afterwards
+   bfd_canonicalize_reloc simply hands back the cached relocations.  */
+
+bool
+bfd_som_slurp_all_relocs (bfd *abfd, asymbol **symbols)
+{
+  asection *section;
+  file_ptr start = -1, end = 0;
+  unsigned char *fixups;
+  void *fixups_map;
+  size_t fixups_map_size;
+
+  if (bfd_get_format (abfd) != bfd_object)
+    {
+      bfd_set_error (bfd_error_invalid_operation);
+      return false;
+    }
+
+  /* Find the extent of the streams which still need reading.  Anything
+     already counted by som_get_reloc_upper_bound has its own copy.  */
+  for (section = abfd->sections; section != NULL; section = section->next)
+    {
+      file_ptr sec_end;
+
+      if (!som_reloc_stream_unread (section))
+	continue;
+
+      sec_end = section->rel_filepos + som_section_data (section)->reloc_size;
+      if (start < 0 || section->rel_filepos < start)
+	start = section->rel_filepos;
+      if (sec_end > end)
+	end = sec_end;
+    }
+
+  if (start >= 0)
+    {
+      fixups = som_read_temporary (abfd, obj_som_reloc_filepos (abfd) + start,
+				   end - start, &fixups_map, &fixups_map_size);
+      if (fixups == NULL)
+	return false;
+
+      for (section = abfd->sections; section != NULL; section = section->next)
+	{
+	  unsigned char *external_relocs;
+
+	  if (!som_reloc_stream_unread (section))
+	    continue;
+
+	  external_relocs = fixups + (section->rel_filepos - start);
+	  som_section_data (section)->reloc_stream = external_relocs;
+	  if (!decode_external_relocs (abfd, section, external_relocs,
+				       som_section_data (section)->reloc_size,
+				       symbols))
+	    {
+	      _bfd_munmap_readonly_temporary (fixups_map, fixups_map_size);
+	      return false;
+	    }
+	}
+
+      _bfd_munmap_readonly_temporary (fixups_map, fixups_map_size);
+    }
+
+  /* Pick up whatever was left half done by earlier calls.  */
+  for (section = abfd->sections; section != NULL; section = section->next)
+    if ((section->flags & SEC_RELOC) != 0
+	&& !som_slurp_reloc_table (abfd, section, symbols, false))
+      return false;
+
+  return true;
+}
+
 extern const bfd_target hppa_som_vec;
 
 /* A hook to set up object file dependent section information.  */
@@ -5891,7 +7822,7 @@ extern const bfd_target hppa_som_vec;
 static bool
 som_new_section_hook (bfd *abfd, asection *newsect)
 {
-  const size_t SECTION_DATA_SIZE = sizeof (struct som_section_data_struct);
+  const size_t SECTION_DATA_SIZE = sizeof (struct som_private_section_data);
   const unsigned int DEFAULT_ALIGNMENT_POWER = 3;
 
   newsect->used_by_bfd = bfd_zalloc (abfd, SECTION_DATA_SIZE);
@@ -5937,11 +7868,10 @@ is_valid_som_section(bfd *ibfd, bfd *obfd, asection *isection)
 }
 
 static bool
-allocate_copy_data(bfd *obfd, asection *osection)
+allocate_copy_data(bfd *obfd ATTRIBUTE_UNUSED, asection *osection)
 {
-    size_t amt = sizeof(struct som_copyable_section_data_struct);
-    som_section_data(osection)->copy_data = bfd_zalloc(obfd, amt);
-    return som_section_data(osection)->copy_data != NULL;
+    som_get_copy_data(osection);
+    return true;
 }
 
 static void
@@ -6106,16 +8036,8 @@ bfd_som_set_section_attributes (asection *section,
 				unsigned int sort_key,
 				int spnum)
 {
-  if (som_section_data (section)->copy_data == NULL)
-    {
-      size_t amt = sizeof (struct som_copyable_section_data_struct);
+  struct som_copyable_section_data_struct *copy_data = som_get_copy_data (section);
 
-      som_section_data (section)->copy_data = bfd_zalloc (section->owner, amt);
-      if (som_section_data (section)->copy_data == NULL)
-	return false;
-    }
-  
-  struct som_copyable_section_data_struct *copy_data = som_section_data (section)->copy_data;
   copy_data->sort_key = sort_key;
   copy_data->is_defined = defined;
   copy_data->is_private = private;
@@ -6139,16 +8061,7 @@ bfd_som_set_subsection_attributes (asection *section,
 {
   struct som_copyable_section_data_struct *copy_data;
   
-  copy_data = som_section_data (section)->copy_data;
-  
-  if (copy_data == NULL)
-    {
-      size_t amt = sizeof (struct som_copyable_section_data_struct);
-      copy_data = bfd_zalloc (section->owner, amt);
-      if (copy_data == NULL)
-	return false;
-      som_section_data (section)->copy_data = copy_data;
-    }
+  copy_data = som_get_copy_data (section);
   
   copy_data->sort_key = sort_key;
   copy_data->access_control_bits = access_ctr;
@@ -6303,18 +8216,157 @@ static bool is_valid_section_read(sec_ptr section, file_ptr offset, bfd_size_typ
 static bool perform_section_read(bfd *abfd, sec_ptr section, void *location, 
                                  file_ptr offset, bfd_size_type count)
 {
+    SOM_STAT_ADD(abfd, section_reads, 1);
+    SOM_STAT_ADD(abfd, seeks, 1);
+    SOM_STAT_ADD(abfd, bytes_read, count);
     if (bfd_seek(abfd, section->filepos + offset, SEEK_SET) != 0)
         return false;
     
     return bfd_read(location, count, abfd) == count;
 }
 
+/* Let the contents cache of SOM input BFD ABFD use up to BUDGET
+   bytes, or turn the cache off if BUDGET is smaller than a page.
+   Pages already cached are dropped.  The memory is given back by
+   bfd_free_cached_info.  */
+
+bool
+bfd_som_set_contents_cache_size (bfd *abfd, size_t budget)
+{
+  if (bfd_get_flavour (abfd) != bfd_target_som_flavour
+      || bfd_get_format (abfd) != bfd_object)
+    {
+      bfd_set_error (bfd_error_invalid_operation);
+      return false;
+    }
+
+  som_free_page_cache (abfd);
+  som_private_data (abfd)->page_cache.budget = budget;
+  return true;
+}
+
+/* Return the page of ABFD starting at file offset POS, reading it in
+   if it is not in the cache, or NULL on error.  */
+
+static struct som_cached_page *
+som_get_cached_page (bfd *abfd, file_ptr pos)
+{
+  struct som_page_cache *cache = &som_private_data (abfd)->page_cache;
+  struct som_cached_page *page;
+  bfd_size_type got;
+
+  page = &cache->slots[(pos / SOM_PAGE_CACHE_PAGE_SIZE) % cache->count];
+  if (page->data != NULL && page->pos == pos)
+    {
+      SOM_STAT_ADD (abfd, page_cache_hits, 1);
+      return page;
+    }
+  SOM_STAT_ADD (abfd, page_cache_misses, 1);
+
+  if (page->data == NULL)
+    {
+      page->data = bfd_malloc (SOM_PAGE_CACHE_PAGE_SIZE);
+      if (page->data == NULL)
+	return NULL;
+    }
+  page->pos = -1;
+  if (bfd_seek (abfd, pos, SEEK_SET) != 0)
+    return NULL;
+  got = bfd_read (page->data, SOM_PAGE_CACHE_PAGE_SIZE, abfd);
+  if (got == (bfd_size_type) -1 || got == 0)
+    return NULL;
+  SOM_STAT_ADD (abfd, seeks, 1);
+  SOM_STAT_ADD (abfd, bytes_read, got);
+  page->pos = pos;
+  page->len = got;
+  return page;
+}
+
+/* Read COUNT bytes at file offset POS of ABFD into LOCATION through
+   the contents cache.  Return false with *USED clear if the cache is
+   not to be used for this read, so that the caller reads the file
+   itself.  */
+
+static bool
+som_cached_read (bfd *abfd, file_ptr pos, void *location, size_t count,
+		 bool *used)
+{
+  struct som_page_cache *cache = &som_private_data (abfd)->page_cache;
+  bfd_byte *dst = location;
+
+  *used = false;
+  if (count > SOM_PAGE_CACHE_PAGE_SIZE
+      || abfd->direction != read_direction
+      || (abfd->flags & BFD_IN_MEMORY) != 0)
+    return false;
+
+  if (cache->slots == NULL)
+    {
+      size_t n = cache->budget / SOM_PAGE_CACHE_PAGE_SIZE;
+
+      if (n == 0)
+	return false;
+      cache->slots = bfd_zmalloc (n * sizeof (*cache->slots));
+      if (cache->slots == NULL)
+	return false;
+      cache->count = n;
+    }
+
+  *used = true;
+  SOM_STAT_ADD (abfd, section_reads, 1);
+  while (count != 0)
+    {
+      file_ptr base = pos - pos % SOM_PAGE_CACHE_PAGE_SIZE;
+      struct som_cached_page *page = som_get_cached_page (abfd, base);
+      size_t off = pos - base, n;
+
+      if (page == NULL)
+	return false;
+      if (off >= page->len)
+	{
+	  bfd_set_error (bfd_error_file_truncated);
+	  return false;
+	}
+      n = page->len - off;
+      if (n > count)
+	n = count;
+      memcpy (dst, page->data + off, n);
+      dst += n;
+      pos += n;
+      count -= n;
+    }
+  return true;
+}
+
+static void
+som_free_page_cache (bfd *abfd)
+{
+  struct som_page_cache *cache = &som_private_data (abfd)->page_cache;
+  size_t i;
+
+  if (cache->slots == NULL)
+    return;
+  for (i = 0; i < cache->count; i++)
+    free (cache->slots[i].data);
+  free (cache->slots);
+  cache->slots = NULL;
+  cache->count = 0;
+}
+
 static bool som_get_section_contents(bfd *abfd, sec_ptr section, void *location,
                                      file_ptr offset, bfd_size_type count)
 {
+    bool ok, used;
+
     if (!is_valid_section_read(section, offset, count))
         return count == 0 || ((section->flags & SEC_HAS_CONTENTS) == 0);
     
+    /* Small reads are served from the cache of recently read pages.  */
+    ok = som_cached_read(abfd, section->filepos + offset, location, count,
+                         &used);
+    if (used)
+        return ok;
+
     return perform_section_read(abfd, section, location, offset, count);
 }
 
@@ -6324,10 +8376,10 @@ initialize_output_if_needed(bfd *abfd)
   if (abfd->output_has_begun)
     return true;
     
-  som_prep_headers(abfd);
+  if (!som_prep_headers(abfd))
+    return false;
   abfd->output_has_begun = true;
-  som_begin_writing(abfd);
-  return true;
+  return som_begin_writing(abfd);
 }
 
 static bool
@@ -6337,16 +8389,138 @@ is_writable_subspace(sec_ptr section)
          (section->flags & SEC_HAS_CONTENTS) != 0;
 }
 
+/* Size of the buffer gathering subspace contents, and the largest
+   gap between two pieces of content which is zero filled instead of
+   being seeked over.  */
+#define SOM_CONTENT_BUFFER_SIZE (256 * 1024)
+#define SOM_CONTENT_MAX_GAP (16 * PA_PAGESIZE)
+
+/* Write out any buffered subspace contents of ABFD.  */
+
+static bool
+som_flush_contents (bfd *abfd)
+{
+  struct som_content_buffer *cb = &som_private_data (abfd)->contents;
+
+  if (cb->used == 0)
+    return true;
+  SOM_STAT_ADD (abfd, seeks, 1);
+  SOM_STAT_ADD (abfd, writes, 1);
+  SOM_STAT_ADD (abfd, bytes_written, cb->used);
+  if (bfd_seek (abfd, cb->start, SEEK_SET) != 0
+      || bfd_write (cb->buf, cb->used, abfd) != cb->used)
+    return false;
+  cb->start += cb->used;
+  cb->used = 0;
+  return true;
+}
+
+/* Append COUNT bytes from DATA, or COUNT zero bytes if DATA is NULL,
+   to the buffered contents of ABFD.  */
+
+static bool
+som_buffer_contents (bfd *abfd, const bfd_byte *data, bfd_size_type count)
+{
+  struct som_content_buffer *cb = &som_private_data (abfd)->contents;
+
+  while (count > 0)
+    {
+      size_t n;
+
+      if (cb->used == cb->size && !som_flush_contents (abfd))
+	return false;
+
+      /* Nothing to gather a big piece of content with; write it
+	 straight out.  */
+      if (cb->used == 0 && data != NULL && count >= cb->size)
+	{
+	  SOM_STAT_ADD (abfd, seeks, 1);
+	  SOM_STAT_ADD (abfd, writes, 1);
+	  SOM_STAT_ADD (abfd, bytes_written, count);
+	  if (bfd_seek (abfd, cb->start, SEEK_SET) != 0
+	      || bfd_write (data, count, abfd) != count)
+	    return false;
+	  cb->start += count;
+	  break;
+	}
+
+      n = cb->size - cb->used;
+      if (n > count)
+	n = count;
+      if (data != NULL)
+	{
+	  memcpy (cb->buf + cb->used, data, n);
+	  data += n;
+	}
+      else
+	memset (cb->buf + cb->used, 0, n);
+      cb->used += n;
+      count -= n;
+    }
+
+  if (cb->start + (file_ptr) cb->used > cb->high_water)
+    cb->high_water = cb->start + cb->used;
+  return true;
+}
+
+/* Release the content buffer of ABFD, dropping anything unwritten.  */
+
+static void
+som_free_contents (bfd *abfd)
+{
+  struct som_content_buffer *cb = &som_private_data (abfd)->contents;
+
+  free (cb->buf);
+  memset (cb, 0, sizeof (*cb));
+}
+
+/* Write COUNT bytes of SECTION's contents at OFFSET.  Contents which
+   continue where the previous write stopped, or which only skip over
+   padding no one else writes, are buffered; anything else first
+   flushes the buffer and starts a new run.  */
+
 static bool
 write_section_data(bfd *abfd, sec_ptr section, const void *location,
                    file_ptr offset, bfd_size_type count)
 {
+  struct som_content_buffer *cb = &som_private_data (abfd)->contents;
+  file_ptr end;
+
+  if (count == 0)
+    return true;
+
   offset += som_section_data(section)->subspace_dict->file_loc_init_value;
-  
-  if (bfd_seek(abfd, offset, SEEK_SET) != 0)
-    return false;
-    
-  return bfd_write(location, count, abfd) == count;
+
+  if (cb->buf == NULL)
+    {
+      cb->buf = bfd_malloc (SOM_CONTENT_BUFFER_SIZE);
+      if (cb->buf == NULL)
+	return false;
+      cb->size = SOM_CONTENT_BUFFER_SIZE;
+      cb->used = 0;
+      cb->start = offset;
+    }
+
+  end = cb->start + cb->used;
+  if (offset != end)
+    {
+      if (offset > end
+	  && end == cb->high_water
+	  && cb->high_water != 0
+	  && offset - end <= SOM_CONTENT_MAX_GAP)
+	{
+	  if (!som_buffer_contents (abfd, NULL, offset - end))
+	    return false;
+	}
+      else
+	{
+	  if (!som_flush_contents (abfd))
+	    return false;
+	  cb->start = offset;
+	}
+    }
+
+  return som_buffer_contents (abfd, location, count);
 }
 
 static bool
@@ -6356,7 +8530,8 @@ som_set_section_contents(bfd *abfd,
                         file_ptr offset,
                         bfd_size_type count)
 {
-  initialize_output_if_needed(abfd);
+  if (!initialize_output_if_needed(abfd))
+    return false;
   
   if (!is_writable_subspace(section))
     return true;
@@ -6372,32 +8547,118 @@ som_set_arch_mach (bfd *abfd,
   return bfd_default_set_arch_mach (abfd, arch, machine);
 }
 
-static bool is_valid_function_symbol(som_symbol_type *q, asection *section, bfd_vma offset, bfd_vma low_func)
+static bool is_function_som_type(pa_symbol_type type)
+{
+    return type == SYMBOL_TYPE_ENTRY
+           || type == SYMBOL_TYPE_PRI_PROG
+           || type == SYMBOL_TYPE_SEC_PROG
+           || type == SYMBOL_TYPE_MILLICODE;
+}
+
+static int compare_func_entries(const void *arg1, const void *arg2)
 {
-    return q->som_type == SYMBOL_TYPE_ENTRY
-           && q->symbol.section == section
-           && q->symbol.value >= low_func
-           && q->symbol.value <= offset;
+    const struct som_func_entry *f1 = arg1;
+    const struct som_func_entry *f2 = arg2;
+
+    if (f1->section_id != f2->section_id)
+        return f1->section_id < f2->section_id ? -1 : 1;
+    if (f1->value != f2->value)
+        return f1->value < f2->value ? -1 : 1;
+    if (f1->pos != f2->pos)
+        return f1->pos < f2->pos ? -1 : 1;
+    return 0;
 }
 
-static asymbol* find_function_from_symbols(asymbol **symbols, asection *section, bfd_vma offset)
+/* Build the address index of the function symbols in SYMBOLS.  */
+
+static bool build_function_index(bfd *abfd, asymbol **symbols)
 {
-    asymbol *func = NULL;
-    bfd_vma low_func = 0;
+    struct som_private_data *sdata = som_private_data(abfd);
+    struct som_func_entry *index;
+    unsigned int count = 0, i;
     asymbol **p;
+    size_t amt;
 
     for (p = symbols; *p != NULL; p++)
+        if (is_function_som_type(((som_symbol_type *) *p)->som_type))
+            count++;
+
+    if (_bfd_mul_overflow(count, sizeof(*index), &amt))
+    {
+        bfd_set_error(bfd_error_file_too_big);
+        return false;
+    }
+    index = bfd_malloc(amt != 0 ? amt : 1);
+    if (index == NULL)
+        return false;
+
+    for (p = symbols, i = 0; *p != NULL; p++)
     {
         som_symbol_type *q = (som_symbol_type *) *p;
-        
-        if (is_valid_function_symbol(q, section, offset, low_func))
-        {
-            func = (asymbol *) q;
-            low_func = q->symbol.value;
-        }
+
+        if (!is_function_som_type(q->som_type))
+            continue;
+        index[i].section_id = q->symbol.section->id;
+        index[i].value = q->symbol.value;
+        index[i].pos = p - symbols;
+        index[i].sym = q;
+        i++;
     }
-    
-    return func;
+
+    qsort(index, count, sizeof(*index), compare_func_entries);
+
+    free(sdata->func_index);
+    sdata->func_index = index;
+    sdata->func_index_count = count;
+    return true;
+}
+
+/* Return the function symbol in SECTION nearest below or at OFFSET.
+   If several share that address prefer the ST_ENTRY one, and then the
+   last one in the symbol table.  */
+
+static asymbol* find_function_from_symbols(bfd *abfd, asymbol **symbols,
+                                           asection *section, bfd_vma offset)
+{
+    struct som_private_data *sdata = som_private_data(abfd);
+    struct som_func_entry *index;
+    struct som_func_entry *best;
+    unsigned int lo = 0, hi;
+
+    if (sdata->func_index == NULL && !build_function_index(abfd, symbols))
+        return NULL;
+
+    /* Find the first entry past (SECTION, OFFSET).  */
+    index = sdata->func_index;
+    hi = sdata->func_index_count;
+    while (lo < hi)
+    {
+        unsigned int mid = lo + (hi - lo) / 2;
+
+        if (index[mid].section_id < section->id
+            || (index[mid].section_id == section->id
+                && index[mid].value <= offset))
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    if (lo == 0 || index[lo - 1].section_id != section->id)
+        return NULL;
+
+    best = &index[lo - 1];
+    for (unsigned int i = lo - 1;
+         best->sym->som_type != SYMBOL_TYPE_ENTRY && i > 0; )
+    {
+        i--;
+        if (index[i].section_id != section->id
+            || index[i].value != best->value)
+            break;
+        if (index[i].sym->som_type == SYMBOL_TYPE_ENTRY)
+            best = &index[i];
+    }
+
+    return &best->sym->symbol;
 }
 
 static void set_function_info(const char **filename_ptr, const char **functionname_ptr, 
@@ -6435,7 +8696,7 @@ static bool som_find_nearest_line(bfd *abfd,
     if (symbols == NULL)
         return false;
 
-    func = find_function_from_symbols(symbols, section, offset);
+    func = find_function_from_symbols(abfd, symbols, section, offset);
     
     if (func == NULL)
         return false;
@@ -6536,304 +8797,134 @@ som_get_symbol_info (bfd *ignore_abfd ATTRIBUTE_UNUSED,
   ret->name = symbol->name;
 }
 
-/* Count the number of symbols in the archive symbol table.  Necessary
-   so that we can allocate space for all the carsyms at once.  */
-
-static bool
-read_hash_table(bfd *abfd, struct som_lst_header *lst_header, unsigned char **hash_table)
-{
-  size_t amt;
-  
-  if (_bfd_mul_overflow(lst_header->hash_size, 4, &amt))
-    {
-      bfd_set_error(bfd_error_file_too_big);
-      return false;
-    }
-  
-  *hash_table = _bfd_malloc_and_read(abfd, amt, amt);
-  return (*hash_table != NULL || lst_header->hash_size == 0);
-}
+/* Return the name at NAME in the string area of the LST image LST of
+   LST_SIZE bytes, or NULL if it does not lie within the image.  The
+   name points into the image when it is terminated there.  */
 
-static bool
-read_symbol_at_offset(bfd *abfd, file_ptr lst_filepos, unsigned int offset,
-                      struct som_external_lst_symbol_record *symbol)
+static const char *
+som_lst_symbol_name (bfd *abfd, const bfd_byte *lst, size_t lst_size,
+		     const struct som_lst_header *lst_header,
+		     unsigned int name)
 {
-  if (bfd_seek(abfd, lst_filepos + offset, SEEK_SET) != 0)
-    return false;
-    
-  size_t amt = sizeof(*symbol);
-  return bfd_read(symbol, amt, abfd) == amt;
-}
+  size_t pos, len;
+  char *copy;
 
-static bool
-validate_next_entry(unsigned int next_entry, unsigned int current_offset,
-                   size_t symbol_size)
-{
-  if (next_entry == 0)
-    return true;
-    
-  if (next_entry < current_offset + symbol_size)
+  if (name < 4
+      || lst_header->string_loc > lst_size
+      || name > lst_size - lst_header->string_loc)
     {
-      bfd_set_error(bfd_error_bad_value);
-      return false;
+      bfd_set_error (bfd_error_bad_value);
+      return NULL;
     }
-  return true;
-}
-
-static bool
-count_chain_symbols(bfd *abfd, file_ptr lst_filepos, unsigned int hash_val,
-                   symindex *count)
-{
-  struct som_external_lst_symbol_record ext_lst_symbol;
-  
-  if (hash_val == 0)
-    return true;
-    
-  if (!read_symbol_at_offset(abfd, lst_filepos, hash_val, &ext_lst_symbol))
-    return false;
-    
-  (*count)++;
-  
-  while (1)
+  pos = (size_t) lst_header->string_loc + name;
+  len = bfd_getb32 (lst + pos - 4);
+  if (len > lst_size - pos)
     {
-      unsigned int next_entry = bfd_getb32(ext_lst_symbol.next_entry);
-      
-      if (!validate_next_entry(next_entry, hash_val, sizeof(ext_lst_symbol)))
-        return false;
-        
-      if (next_entry == 0)
-        break;
-        
-      hash_val = next_entry;
-      
-      if (!read_symbol_at_offset(abfd, lst_filepos, next_entry, &ext_lst_symbol))
-        return false;
-        
-      (*count)++;
+      bfd_set_error (bfd_error_bad_value);
+      return NULL;
     }
-    
-  return true;
-}
 
-static bool
-som_bfd_count_ar_symbols(bfd *abfd,
-                        struct som_lst_header *lst_header,
-                        symindex *count)
-{
-  unsigned int i;
-  unsigned char *hash_table = NULL;
-  file_ptr lst_filepos;
-  
-  lst_filepos = bfd_tell(abfd) - sizeof(struct som_external_lst_header);
-  
-  if (!read_hash_table(abfd, lst_header, &hash_table))
-    return false;
-  
-  *count = 0;
-  
-  for (i = 0; i < lst_header->hash_size; i++)
-    {
-      unsigned int hash_val = bfd_getb32(hash_table + 4 * i);
-      
-      if (!count_chain_symbols(abfd, lst_filepos, hash_val, count))
-        {
-          free(hash_table);
-          return false;
-        }
-    }
-    
-  free(hash_table);
-  return true;
+  if (len < lst_size - pos && lst[pos + len] == 0)
+    return (const char *) lst + pos;
+
+  copy = bfd_alloc (abfd, len + 1);
+  if (copy == NULL)
+    return NULL;
+  memcpy (copy, lst + pos, len);
+  copy[len] = 0;
+  return copy;
 }
 
-/* Fill in the canonical archive symbols (SYMS) from the archive described
-   by ABFD and LST_HEADER.  */
+/* Build the canonical archive symbols of ABFD from the LST image LST
+   of LST_SIZE bytes described by LST_HEADER, walking every hash chain
+   once.  Set *SYMDEFS and *COUNT to the result.  */
 
 static bool
-read_hash_table(bfd *abfd, struct som_lst_header *lst_header, unsigned char **hash_table)
-{
-  size_t amt;
-  
-  if (_bfd_mul_overflow(lst_header->hash_size, 4, &amt))
-    {
-      bfd_set_error(bfd_error_file_too_big);
-      return false;
-    }
-  
-  *hash_table = _bfd_malloc_and_read(abfd, amt, amt);
-  return (*hash_table != NULL || lst_header->hash_size == 0);
-}
+som_bfd_read_ar_symbols (bfd *abfd, const bfd_byte *lst, size_t lst_size,
+			 const struct som_lst_header *lst_header,
+			 carsym **symdefs, symindex *count)
+{
+  const size_t rec_size = sizeof (struct som_external_lst_symbol_record);
+  const struct som_external_som_entry *som_dict;
+  carsym *syms = NULL;
+  size_t n = 0, alloc = 0, amt;
+  unsigned int i;
 
-static bool
-read_som_dictionary(bfd *abfd, file_ptr lst_filepos, struct som_lst_header *lst_header,
-                    struct som_external_som_entry **som_dict)
-{
-  size_t amt;
-  
-  if (bfd_seek(abfd, lst_filepos + lst_header->dir_loc, SEEK_SET) != 0)
-    return false;
-  
-  if (_bfd_mul_overflow(lst_header->module_count,
-                        sizeof(struct som_external_som_entry), &amt))
+  if (lst_header->hash_loc > lst_size
+      || lst_header->hash_size > (lst_size - lst_header->hash_loc) / 4
+      || lst_header->dir_loc > lst_size
+      || (lst_header->module_count
+	  > ((lst_size - lst_header->dir_loc)
+	     / sizeof (struct som_external_som_entry))))
     {
-      bfd_set_error(bfd_error_file_too_big);
+      bfd_set_error (bfd_error_malformed_archive);
       return false;
     }
-  
-  *som_dict = (struct som_external_som_entry *)_bfd_malloc_and_read(abfd, amt, amt);
-  return (*som_dict != NULL || lst_header->module_count == 0);
-}
+  som_dict = (const struct som_external_som_entry *) (lst + lst_header->dir_loc);
 
-static bool
-read_symbol_name(bfd *abfd, file_ptr lst_filepos, unsigned int string_loc,
-                 unsigned int name_offset, char **name)
-{
-  unsigned char ext_len[4];
-  size_t len;
-  
-  if (bfd_seek(abfd, lst_filepos + string_loc + name_offset - 4, SEEK_SET) != 0)
-    return false;
-  
-  if (bfd_read(&ext_len, 4, abfd) != 4)
-    return false;
-  
-  len = bfd_getb32(ext_len);
-  
-  if (len == (size_t)-1)
+  for (i = 0; i < lst_header->hash_size; i++)
     {
-      bfd_set_error(bfd_error_no_memory);
-      return false;
-    }
-  
-  *name = (char *)_bfd_alloc_and_read(abfd, len + 1, len);
-  if (!*name)
-    return false;
-  
-  (*name)[len] = 0;
-  return true;
-}
+      unsigned int offset = bfd_getb32 (lst + lst_header->hash_loc + 4 * i);
 
-static bool
-set_file_offset(carsym *set, unsigned int som_index, unsigned int module_count,
-                struct som_external_som_entry *som_dict)
-{
-  if (som_index >= module_count)
-    {
-      bfd_set_error(bfd_error_bad_value);
-      return false;
+      while (offset != 0)
+	{
+	  const struct som_external_lst_symbol_record *lst_symbol;
+	  unsigned int ndx;
+
+	  /* Each record belongs to one chain, so no more of them can be
+	     visited than fit in the LST; a cycle is caught by that.  */
+	  if (offset > lst_size || rec_size > lst_size - offset
+	      || n >= lst_size / rec_size)
+	    goto bad_value;
+	  lst_symbol = (const struct som_external_lst_symbol_record *)
+	    (lst + offset);
+
+	  if (n == alloc)
+	    {
+	      carsym *grown;
+
+	      alloc = alloc == 0 ? 64 : alloc * 2;
+	      if (_bfd_mul_overflow (alloc, sizeof (*syms), &amt))
+		{
+		  bfd_set_error (bfd_error_file_too_big);
+		  goto error_return;
+		}
+	      grown = bfd_realloc (syms, amt);
+	      if (grown == NULL)
+		goto error_return;
+	      syms = grown;
+	    }
+
+	  syms[n].name = som_lst_symbol_name (abfd, lst, lst_size, lst_header,
+					      bfd_getb32 (lst_symbol->name));
+	  if (syms[n].name == NULL)
+	    goto error_return;
+
+	  ndx = bfd_getb32 (lst_symbol->som_index);
+	  if (ndx >= lst_header->module_count)
+	    goto bad_value;
+	  syms[n].file_offset = (bfd_getb32 (som_dict[ndx].location)
+				 - sizeof (struct ar_hdr));
+	  n++;
+
+	  offset = bfd_getb32 (lst_symbol->next_entry);
+	}
     }
-  
-  set->file_offset = bfd_getb32(som_dict[som_index].location) - sizeof(struct ar_hdr);
-  return true;
-}
-
-static bool
-read_lst_symbol(bfd *abfd, file_ptr position,
-                struct som_external_lst_symbol_record *lst_symbol)
-{
-  size_t amt = sizeof(*lst_symbol);
-  
-  if (bfd_seek(abfd, position, SEEK_SET) != 0)
-    return false;
-  
-  return bfd_read(lst_symbol, amt, abfd) == amt;
-}
 
-static bool
-process_symbol(bfd *abfd, file_ptr lst_filepos, unsigned int string_loc,
-               struct som_external_lst_symbol_record *lst_symbol,
-               struct som_lst_header *lst_header,
-               struct som_external_som_entry *som_dict,
-               carsym *set)
-{
-  char *name;
-  unsigned int ndx;
-  
-  if (!read_symbol_name(abfd, lst_filepos, string_loc,
-                        bfd_getb32(lst_symbol->name), &name))
-    return false;
-  
-  set->name = name;
-  
-  ndx = bfd_getb32(lst_symbol->som_index);
-  return set_file_offset(set, ndx, lst_header->module_count, som_dict);
-}
-
-static bool
-process_chain(bfd *abfd, file_ptr lst_filepos, unsigned int hash_val,
-              unsigned int string_loc, struct som_lst_header *lst_header,
-              struct som_external_som_entry *som_dict, carsym **set)
-{
-  struct som_external_lst_symbol_record lst_symbol;
-  unsigned int next_entry;
-  
-  if (!read_lst_symbol(abfd, lst_filepos + hash_val, &lst_symbol))
-    return false;
-  
-  if (!process_symbol(abfd, lst_filepos, string_loc, &lst_symbol,
-                      lst_header, som_dict, *set))
-    return false;
-  
-  (*set)++;
-  
-  next_entry = bfd_getb32(lst_symbol.next_entry);
-  while (next_entry != 0)
-    {
-      if (!read_lst_symbol(abfd, lst_filepos + next_entry, &lst_symbol))
-        return false;
-      
-      if (!process_symbol(abfd, lst_filepos, string_loc, &lst_symbol,
-                          lst_header, som_dict, *set))
-        return false;
-      
-      (*set)++;
-      next_entry = bfd_getb32(lst_symbol.next_entry);
-    }
-  
+  *symdefs = bfd_alloc (abfd, n * sizeof (*syms) + 1);
+  if (*symdefs == NULL)
+    goto error_return;
+  if (n != 0)
+    memcpy (*symdefs, syms, n * sizeof (*syms));
+  free (syms);
+  *count = n;
   return true;
-}
 
-static bool
-som_bfd_fill_in_ar_symbols(bfd *abfd,
-                          struct som_lst_header *lst_header,
-                          carsym **syms)
-{
-  unsigned int i;
-  carsym *set = syms[0];
-  unsigned char *hash_table = NULL;
-  struct som_external_som_entry *som_dict = NULL;
-  file_ptr lst_filepos;
-  unsigned int string_loc;
-  bool result = false;
-  
-  lst_filepos = bfd_tell(abfd) - sizeof(struct som_external_lst_header);
-  
-  if (!read_hash_table(abfd, lst_header, &hash_table))
-    goto cleanup;
-  
-  if (!read_som_dictionary(abfd, lst_filepos, lst_header, &som_dict))
-    goto cleanup;
-  
-  string_loc = lst_header->string_loc;
-  
-  for (i = 0; i < lst_header->hash_size; i++)
-    {
-      unsigned int hash_val = bfd_getb32(hash_table + 4 * i);
-      
-      if (hash_val == 0)
-        continue;
-      
-      if (!process_chain(abfd, lst_filepos, hash_val, string_loc,
-                         lst_header, som_dict, &set))
-        goto cleanup;
-    }
-  
-  result = true;
-  
-cleanup:
-  free(hash_table);
-  free(som_dict);
-  return result;
+ bad_value:
+  bfd_set_error (bfd_error_bad_value);
+ error_return:
+  free (syms);
+  return false;
 }
 
 /* Read in the LST from the archive.  */
@@ -6891,48 +8982,211 @@ parse_archive_size(const char *size_str, unsigned int *parsed_size)
   return true;
 }
 
-static bool
-read_and_validate_lst_header(bfd *abfd, struct som_lst_header *lst_header)
+/* Archive map cache.
+
+   When SOM_ARMAP_CACHE_ENV names a directory, the archive map decoded
+   by som_slurp_armap is saved there and reused by later opens of the
+   same archive, which then need not read the LST beyond its header.
+   A cache file starts with a key made up of the archive's device,
+   inode, size and modification time (with nanoseconds where the host
+   has them), the LST size and the external LST header; it is only
+   used when the whole key matches.  Archives modified within the last
+   couple of seconds are not cached, so that one rewritten again within
+   the resolution of its timestamp cannot match a stale entry.  The key
+   is followed by the symbol count and string size, one record per
+   symbol (file offset and name offset), and the NUL terminated names.
+   All numbers are big endian.  Failing to read or write a cache file
+   is never an error; the LST is just read as usual.  */
+
+#define SOM_ARMAP_CACHE_KEY_SIZE \
+  (8 + 5 * 8 + 4 + sizeof (struct som_external_lst_header))
+#define SOM_ARMAP_CACHE_REC_SIZE 12
+
+static void
+som_armap_cache_put64 (bfd_byte *p, uint64_t v)
 {
-  struct som_external_lst_header ext_lst_header;
-  size_t amt = sizeof(struct som_external_lst_header);
-  
-  if (bfd_read(&ext_lst_header, amt, abfd) != amt)
-    return false;
-    
-  som_swap_lst_header_in(&ext_lst_header, lst_header);
-  
-  if (lst_header->a_magic != LIBMAGIC)
-  {
-    bfd_set_error(bfd_error_malformed_archive);
-    return false;
-  }
-  return true;
+  bfd_putb32 (v >> 32, p);
+  bfd_putb32 (v & 0xffffffff, p + 4);
 }
 
-static bool
-allocate_symbol_storage(bfd *abfd, struct artdata *ardata)
+/* Return the malloc'd name of the cache file for archive ABFD, and
+   fill in KEY for it from EXT, the external header of its LST of
+   LST_SIZE bytes.  Return NULL if ABFD is not to be cached.  */
+
+static char *
+som_armap_cache_name (bfd *abfd, const struct som_external_lst_header *ext,
+		      unsigned int lst_size, bfd_byte *key)
 {
+  const char *dir = getenv (SOM_ARMAP_CACHE_ENV);
+  struct stat st;
+  uint64_t nsec = 0;
+  char *name;
+
+  if (dir == NULL || *dir == '\0'
+      || abfd->my_archive != NULL
+      || (abfd->flags & BFD_IN_MEMORY) != 0
+      || bfd_stat (abfd, &st) != 0
+      || st.st_mtime >= time (NULL) - 1)
+    return NULL;
+
+#if defined (HAVE_STRUCT_STAT_ST_MTIM_TV_NSEC)
+  nsec = st.st_mtim.tv_nsec;
+#elif defined (HAVE_STRUCT_STAT_ST_MTIMESPEC_TV_NSEC)
+  nsec = st.st_mtimespec.tv_nsec;
+#endif
+
+  memcpy (key, SOM_ARMAP_CACHE_MAGIC, 8);
+  som_armap_cache_put64 (key + 8, st.st_dev);
+  som_armap_cache_put64 (key + 16, st.st_ino);
+  som_armap_cache_put64 (key + 24, st.st_size);
+  som_armap_cache_put64 (key + 32, st.st_mtime);
+  som_armap_cache_put64 (key + 40, nsec);
+  bfd_putb32 (lst_size, key + 48);
+  memcpy (key + 52, ext, sizeof (*ext));
+
+  name = bfd_malloc (strlen (dir) + 64);
+  if (name != NULL)
+    sprintf (name, "%s/som-armap-%lx-%lx", dir,
+	     (unsigned long) st.st_dev, (unsigned long) st.st_ino);
+  return name;
+}
+
+/* Try to set up the archive map of ABFD from cache file NAME, which
+   must start with KEY.  Return true if that worked.  */
+
+static bool
+som_armap_cache_load (bfd *abfd, const char *name, const bfd_byte *key)
+{
+  struct artdata *ardata = bfd_ardata (abfd);
+  bfd_byte *buf = NULL;
+  const bfd_byte *recs;
+  char *strings;
+  unsigned int count, strsize, i;
+  long fsize;
   size_t amt;
-  
-  ardata->cache = 0;
-  
-  if (_bfd_mul_overflow(ardata->symdef_count, sizeof(carsym), &amt))
-  {
-    bfd_set_error(bfd_error_file_too_big);
+  carsym *syms;
+  FILE *f;
+
+  f = _bfd_real_fopen (name, FOPEN_RB);
+  if (f == NULL)
     return false;
-  }
-  
-  ardata->symdefs = bfd_alloc(abfd, amt);
-  return ardata->symdefs != NULL;
+  if (fseek (f, 0, SEEK_END) != 0
+      || (fsize = ftell (f)) < (long) SOM_ARMAP_CACHE_KEY_SIZE + 8
+      || fseek (f, 0, SEEK_SET) != 0
+      || (buf = bfd_malloc (fsize)) == NULL
+      || fread (buf, 1, fsize, f) != (size_t) fsize
+      || memcmp (buf, key, SOM_ARMAP_CACHE_KEY_SIZE) != 0)
+    goto miss;
+
+  count = bfd_getb32 (buf + SOM_ARMAP_CACHE_KEY_SIZE);
+  strsize = bfd_getb32 (buf + SOM_ARMAP_CACHE_KEY_SIZE + 4);
+  recs = buf + SOM_ARMAP_CACHE_KEY_SIZE + 8;
+  amt = fsize - (SOM_ARMAP_CACHE_KEY_SIZE + 8);
+  if (count > amt / SOM_ARMAP_CACHE_REC_SIZE
+      || strsize != amt - (size_t) count * SOM_ARMAP_CACHE_REC_SIZE
+      || (strsize != 0 && recs[amt - 1] != '\0'))
+    goto miss;
+
+  syms = bfd_alloc (abfd, (size_t) count * sizeof (*syms) + strsize + 1);
+  if (syms == NULL)
+    goto miss;
+  strings = (char *) (syms + count);
+  memcpy (strings, recs + (size_t) count * SOM_ARMAP_CACHE_REC_SIZE, strsize);
+
+  for (i = 0; i < count; i++, recs += SOM_ARMAP_CACHE_REC_SIZE)
+    {
+      unsigned int off = bfd_getb32 (recs + 8);
+
+      if (off >= strsize)
+	{
+	  bfd_release (abfd, syms);
+	  goto miss;
+	}
+      syms[i].file_offset = (((uint64_t) bfd_getb32 (recs) << 32)
+			     | bfd_getb32 (recs + 4));
+      syms[i].name = strings + off;
+    }
+
+  ardata->symdefs = syms;
+  ardata->symdef_count = count;
+  free (buf);
+  fclose (f);
+  return true;
+
+ miss:
+  free (buf);
+  fclose (f);
+  return false;
 }
 
-static bool
-seek_to_symbol_table_start(bfd *abfd, struct artdata *ardata, unsigned int parsed_size)
-{
-  return bfd_seek(abfd, (ardata->first_file_filepos - parsed_size
-                        + sizeof(struct som_external_lst_header)),
-                 SEEK_SET) == 0;
+/* Save the archive map of ABFD in cache file NAME under KEY.  The file
+   is written under a temporary name and renamed into place, so that
+   other processes only ever see complete cache files.  The temporary
+   file is created afresh by mkstemps, readable by its owner only, so
+   that nothing planted in a shared cache directory gets written
+   through.  */
+
+static void
+som_armap_cache_store (bfd *abfd, const char *name, const bfd_byte *key)
+{
+  struct artdata *ardata = bfd_ardata (abfd);
+  size_t strsize = 0, size, i;
+  bfd_byte *buf, *p;
+  char *strings, *tmp;
+  bool ok;
+  int fd;
+
+  for (i = 0; i < ardata->symdef_count; i++)
+    strsize += strlen (ardata->symdefs[i].name) + 1;
+  if (ardata->symdef_count > 0xffffffff / SOM_ARMAP_CACHE_REC_SIZE
+      || strsize > 0xffffffff)
+    return;
+
+  size = (SOM_ARMAP_CACHE_KEY_SIZE + 8
+	  + ardata->symdef_count * SOM_ARMAP_CACHE_REC_SIZE + strsize);
+  buf = bfd_malloc (size);
+  tmp = bfd_malloc (strlen (name) + 32);
+  if (buf == NULL || tmp == NULL)
+    {
+      free (buf);
+      free (tmp);
+      return;
+    }
+
+  memcpy (buf, key, SOM_ARMAP_CACHE_KEY_SIZE);
+  bfd_putb32 (ardata->symdef_count, buf + SOM_ARMAP_CACHE_KEY_SIZE);
+  bfd_putb32 (strsize, buf + SOM_ARMAP_CACHE_KEY_SIZE + 4);
+  p = buf + SOM_ARMAP_CACHE_KEY_SIZE + 8;
+  strings = (char *) p + ardata->symdef_count * SOM_ARMAP_CACHE_REC_SIZE;
+  strsize = 0;
+  for (i = 0; i < ardata->symdef_count; i++, p += SOM_ARMAP_CACHE_REC_SIZE)
+    {
+      size_t len = strlen (ardata->symdefs[i].name) + 1;
+
+      som_armap_cache_put64 (p, ardata->symdefs[i].file_offset);
+      bfd_putb32 (strsize, p + 8);
+      memcpy (strings + strsize, ardata->symdefs[i].name, len);
+      strsize += len;
+    }
+
+  sprintf (tmp, "%s.XXXXXX", name);
+  fd = mkstemps (tmp, 0);
+  if (fd >= 0)
+    {
+      ok = true;
+      for (p = buf; ok && p < buf + size; )
+	{
+	  ssize_t n = write (fd, p, buf + size - p);
+
+	  ok = n > 0;
+	  p += ok ? n : 0;
+	}
+      ok &= close (fd) == 0;
+      if (!ok || rename (tmp, name) != 0)
+	unlink (tmp);
+    }
+  free (tmp);
+  free (buf);
 }
 
 static bool
@@ -6943,6 +9197,11 @@ som_slurp_armap(bfd *abfd)
   unsigned int parsed_size;
   struct artdata *ardata = bfd_ardata(abfd);
   char nextname[17];
+  bfd_byte *lst;
+  struct som_external_lst_header ext_header;
+  bfd_byte cache_key[SOM_ARMAP_CACHE_KEY_SIZE];
+  char *cache_name = NULL;
+  struct som_archive_data *adata;
   
   if (!read_archive_name(abfd, nextname))
     return false;
@@ -6958,26 +9217,214 @@ som_slurp_armap(bfd *abfd)
     
   ardata->first_file_filepos = bfd_tell(abfd) + parsed_size;
   
-  if (!read_and_validate_lst_header(abfd, &lst_header))
-    return false;
-    
-  if (!som_bfd_count_ar_symbols(abfd, &lst_header, &ardata->symdef_count))
-    return false;
-    
-  if (!seek_to_symbol_table_start(abfd, ardata, parsed_size))
-    return false;
-    
-  if (!allocate_symbol_storage(abfd, ardata))
-    return false;
-    
-  if (!som_bfd_fill_in_ar_symbols(abfd, &lst_header, &ardata->symdefs))
+  if (parsed_size < sizeof(struct som_external_lst_header))
+  {
+    bfd_set_error(bfd_error_malformed_archive);
     return false;
-    
+  }
+  
+  ardata->cache = 0;
+  ardata->tdata = NULL;
+
+  /* With a cache directory set, look for a saved archive map first;
+     that only needs the LST header.  */
+  if (getenv(SOM_ARMAP_CACHE_ENV) != NULL)
+  {
+    file_ptr lst_pos = bfd_tell(abfd);
+
+    if (bfd_read(&ext_header, sizeof(ext_header), abfd) != sizeof(ext_header))
+      return false;
+    cache_name = som_armap_cache_name(abfd, &ext_header, parsed_size,
+                                      cache_key);
+    if (cache_name != NULL
+        && som_armap_cache_load(abfd, cache_name, cache_key))
+      goto done;
+    if (bfd_seek(abfd, lst_pos, SEEK_SET) != 0)
+      goto error_return;
+  }
+  
+  /* Bring in the whole LST at once; the symbol names point into it.  */
+  lst = _bfd_mmap_readonly_persistent(abfd, parsed_size);
+  if (lst == NULL)
+    goto error_return;
+  
+  som_swap_lst_header_in((struct som_external_lst_header *) lst, &lst_header);
+  if (lst_header.a_magic != LIBMAGIC)
+  {
+    bfd_set_error(bfd_error_malformed_archive);
+    goto error_return;
+  }
+  
+  if (!som_bfd_read_ar_symbols(abfd, lst, parsed_size, &lst_header,
+                               &ardata->symdefs, &ardata->symdef_count))
+    goto error_return;
+  
+  /* Keep the LST around as a name index for bfd_som_find_archive_member.  */
+  adata = bfd_alloc(abfd, sizeof(*adata));
+  if (adata == NULL)
+    goto error_return;
+  adata->lst = lst;
+  adata->lst_size = parsed_size;
+  adata->header = lst_header;
+  adata->hash_size = 0;
+  ardata->tdata = adata;
+
+  if (cache_name != NULL)
+    som_armap_cache_store(abfd, cache_name, cache_key);
+
+ done:
+  free(cache_name);
   if (bfd_seek(abfd, ardata->first_file_filepos, SEEK_SET) != 0)
     return false;
     
   abfd->has_armap = true;
   return true;
+
+ error_return:
+  free(cache_name);
+  return false;
+}
+
+/* Build the name index over the archive map of ABFD used by
+   bfd_som_find_archive_member when there is no LST to search, and
+   return the archive data holding it.  */
+
+static struct som_archive_data *
+som_build_map_index (bfd *abfd)
+{
+  struct artdata *ardata = bfd_ardata (abfd);
+  struct som_archive_data *adata = ardata->tdata;
+  unsigned int nbuckets, i;
+  unsigned int *buckets, *chain;
+  size_t amt;
+
+  if (adata == NULL)
+    {
+      adata = bfd_zalloc (abfd, sizeof (*adata));
+      if (adata == NULL)
+	return NULL;
+      ardata->tdata = adata;
+    }
+  if (adata->map_buckets != NULL)
+    return adata;
+
+  if (ardata->symdef_count >= (unsigned int) -1)
+    {
+      bfd_set_error (bfd_error_file_too_big);
+      return NULL;
+    }
+  for (nbuckets = 1;
+       nbuckets < ardata->symdef_count && nbuckets < 0x80000000;
+       nbuckets <<= 1)
+    ;
+  if (_bfd_mul_overflow (nbuckets + ardata->symdef_count, sizeof (*buckets),
+			 &amt))
+    {
+      bfd_set_error (bfd_error_file_too_big);
+      return NULL;
+    }
+  buckets = bfd_alloc (abfd, amt);
+  if (buckets == NULL)
+    return NULL;
+  memset (buckets, 0xff, nbuckets * sizeof (*buckets));
+  chain = buckets + nbuckets;
+
+  /* The LST's own hash mostly goes by the last character of a name;
+     use a better one.  Insert from the end so that each chain lists
+     entries in map order and a lookup finds the first match.  */
+  for (i = ardata->symdef_count; i-- > 0; )
+    {
+      unsigned int b = (htab_hash_string (ardata->symdefs[i].name)
+			& (nbuckets - 1));
+
+      chain[i] = buckets[b];
+      buckets[b] = i;
+    }
+
+  adata->map_buckets = buckets;
+  adata->map_chain = chain;
+  adata->map_mask = nbuckets - 1;
+  return adata;
+}
+
+/* Return the member of the SOM archive ABFD whose LST entry defines
+   NAME, found through the LST's own hash table, or NULL if no member
+   does.  This gives the same member as the first matching entry of
+   the archive map.  */
+
+bfd *
+bfd_som_find_archive_member (bfd *abfd, const char *name)
+{
+  const struct som_archive_data *adata;
+  const struct som_lst_header *hdr;
+  const bfd_byte *lst;
+  unsigned int len, key, offset;
+
+  if (bfd_get_format (abfd) != bfd_archive
+      || bfd_ardata (abfd) == NULL
+      || !abfd->has_armap)
+    {
+      bfd_set_error (bfd_error_invalid_operation);
+      return NULL;
+    }
+  adata = bfd_ardata (abfd)->tdata;
+  if (adata == NULL || adata->lst == NULL)
+    {
+      /* The map came from the cache, without the LST; search an index
+	 over the map instead.  */
+      const carsym *symdefs = bfd_ardata (abfd)->symdefs;
+      struct som_archive_data *map = som_build_map_index (abfd);
+      unsigned int i;
+
+      if (map == NULL)
+	return NULL;
+      for (i = map->map_buckets[htab_hash_string (name) & map->map_mask];
+	   i != (unsigned int) -1;
+	   i = map->map_chain[i])
+	if (strcmp (symdefs[i].name, name) == 0)
+	  return _bfd_get_elt_at_filepos (abfd, symdefs[i].file_offset, NULL);
+      return NULL;
+    }
+  if (adata->header.hash_size == 0)
+    {
+      bfd_set_error (bfd_error_no_armap);
+      return NULL;
+    }
+
+  hdr = &adata->header;
+  lst = adata->lst;
+  len = strlen (name);
+  if (len == 0)
+    return NULL;
+  key = som_ar_name_hash (name, len);
+
+  /* som_slurp_armap has already bounds-checked every chain and name.  */
+  offset = bfd_getb32 (lst + hdr->hash_loc + 4 * (key % hdr->hash_size));
+  while (offset != 0)
+    {
+      const struct som_external_lst_symbol_record *lst_symbol
+	= (const struct som_external_lst_symbol_record *) (lst + offset);
+
+      if (bfd_getb32 (lst_symbol->symbol_key) == key)
+	{
+	  size_t pos = (size_t) hdr->string_loc + bfd_getb32 (lst_symbol->name);
+
+	  if (bfd_getb32 (lst + pos - 4) == len
+	      && memcmp (lst + pos, name, len) == 0)
+	    {
+	      const struct som_external_som_entry *som_dict
+		= (const struct som_external_som_entry *) (lst + hdr->dir_loc);
+	      unsigned int ndx = bfd_getb32 (lst_symbol->som_index);
+
+	      return _bfd_get_elt_at_filepos (abfd,
+					      (bfd_getb32 (som_dict[ndx].location)
+					       - sizeof (struct ar_hdr)),
+					      NULL);
+	    }
+	}
+      offset = bfd_getb32 (lst_symbol->next_entry);
+    }
+  return NULL;
 }
 
 /* Begin preparing to write a SOM library symbol table.
@@ -7021,8 +9468,29 @@ update_string_size(unsigned int *stringsize, const char *name)
     (*stringsize)++;
 }
 
+/* A symbol going into the LST of an archive, with what the writer
+   needs to know about it.  */
+
+struct som_ar_symbol
+{
+  som_symbol_type *sym;
+  struct som_misc_symbol_info info;
+  unsigned int key;
+};
+
+/* The symbols of every SOM member of an archive which go into its LST,
+   in member order, as collected by som_bfd_prep_for_ar_write.  */
+
+struct som_ar_symtab
+{
+  struct som_ar_symbol *syms;
+  unsigned int count;
+  unsigned int alloc;
+  unsigned int stringsize;
+};
+
 static bool
-process_bfd_symbols(bfd *curr_bfd, unsigned int *num_syms, unsigned int *stringsize)
+process_bfd_symbols(bfd *curr_bfd, struct som_ar_symtab *symtab)
 {
   unsigned int curr_count, i;
   som_symbol_type *sym;
@@ -7035,6 +9503,7 @@ process_bfd_symbols(bfd *curr_bfd, unsigned int *num_syms, unsigned int *strings
 
   for (i = 0; i < curr_count; i++, sym++)
     {
+      struct som_ar_symbol *entry;
       struct som_misc_symbol_info info;
       
       som_bfd_derive_misc_symbol_info(curr_bfd, &sym->symbol, &info);
@@ -7042,28 +9511,51 @@ process_bfd_symbols(bfd *curr_bfd, unsigned int *num_syms, unsigned int *strings
       if (should_exclude_symbol(&info, sym))
         continue;
 
-      (*num_syms)++;
-      update_string_size(stringsize, sym->symbol.name);
+      if (symtab->count == symtab->alloc)
+        {
+          struct som_ar_symbol *grown;
+          size_t amt;
+
+          if (symtab->alloc > ((unsigned int) -1 - 64) / 2
+              || _bfd_mul_overflow(symtab->alloc * 2 + 64, sizeof(*grown), &amt))
+            {
+              bfd_set_error(bfd_error_file_too_big);
+              return false;
+            }
+          grown = bfd_realloc(symtab->syms, amt);
+          if (grown == NULL)
+            return false;
+          symtab->syms = grown;
+          symtab->alloc = symtab->alloc * 2 + 64;
+        }
+
+      entry = &symtab->syms[symtab->count++];
+      entry->sym = sym;
+      entry->info = info;
+      entry->key = som_bfd_ar_symbol_hash(&sym->symbol);
+      update_string_size(&symtab->stringsize, sym->symbol.name);
     }
   
   return true;
 }
 
+/* Collect the symbols of every SOM member of ABFD that go into its LST
+   in SYMTAB, which the caller frees.  Each member's symbol table is
+   read and each symbol classified once here; the writer works from
+   SYMTAB alone.  */
+
 static bool
-som_bfd_prep_for_ar_write(bfd *abfd,
-                          unsigned int *num_syms,
-                          unsigned int *stringsize)
+som_bfd_prep_for_ar_write(bfd *abfd, struct som_ar_symtab *symtab)
 {
   bfd *curr_bfd = abfd->archive_head;
 
-  *num_syms = 0;
-  *stringsize = 0;
+  memset(symtab, 0, sizeof(*symtab));
 
   while (curr_bfd != NULL)
     {
       if (!is_non_som_object(curr_bfd))
         {
-          if (!process_bfd_symbols(curr_bfd, num_syms, stringsize))
+          if (!process_bfd_symbols(curr_bfd, symtab))
             return false;
         }
       
@@ -7077,7 +9569,7 @@ som_bfd_prep_for_ar_write(bfd *abfd,
    SOM ABI.  */
 
 static unsigned int
-som_bfd_ar_symbol_hash (asymbol *symbol)
+som_ar_name_hash (const char *name, unsigned int len)
 {
   #define HASH_LENGTH_MASK 0x7f
   #define HASH_LENGTH_SHIFT 24
@@ -7085,15 +9577,19 @@ som_bfd_ar_symbol_hash (asymbol *symbol)
   #define HASH_CHAR2_SHIFT 8
   #define SINGLE_CHAR_HASH_BASE 0x1000100
 
-  unsigned int len = strlen (symbol->name);
-
   if (len == 1)
-    return SINGLE_CHAR_HASH_BASE | (symbol->name[0] << HASH_CHAR1_SHIFT) | symbol->name[0];
+    return SINGLE_CHAR_HASH_BASE | (name[0] << HASH_CHAR1_SHIFT) | name[0];
 
   return ((len & HASH_LENGTH_MASK) << HASH_LENGTH_SHIFT) 
-         | (symbol->name[1] << HASH_CHAR1_SHIFT)
-         | (symbol->name[len - 2] << HASH_CHAR2_SHIFT) 
-         | symbol->name[len - 1];
+         | (name[1] << HASH_CHAR1_SHIFT)
+         | (name[len - 2] << HASH_CHAR2_SHIFT) 
+         | name[len - 1];
+}
+
+static unsigned int
+som_bfd_ar_symbol_hash (asymbol *symbol)
+{
+  return som_ar_name_hash (symbol->name, strlen (symbol->name));
 }
 
 /* Do the bulk of the work required to write the SOM library
@@ -7181,24 +9677,6 @@ static bool should_skip_bfd(bfd *curr_bfd)
          curr_bfd->xvec->flavour != bfd_target_som_flavour;
 }
 
-static bool should_include_symbol(struct som_misc_symbol_info *info, 
-                                 som_symbol_type *sym)
-{
-  if (info->symbol_type == ST_NULL ||
-      info->symbol_type == ST_SYM_EXT ||
-      info->symbol_type == ST_ARG_EXT)
-    return false;
-
-  if (info->symbol_scope != SS_UNIVERSAL && 
-      info->symbol_type != ST_STORAGE)
-    return false;
-
-  if (bfd_is_und_section(sym->symbol.section))
-    return false;
-
-  return true;
-}
-
 static void update_som_dictionary_if_first(struct som_external_som_entry *som_dict,
                                           unsigned int som_index,
                                           unsigned int curr_som_offset,
@@ -7297,80 +9775,34 @@ static char* update_string_table(bfd *abfd, char *p, const char *name)
   return p;
 }
 
-static bool process_symbol(bfd *curr_bfd,
-                          som_symbol_type *sym,
-                          struct som_external_lst_symbol_record **curr_lst_sym,
-                          struct som_external_lst_symbol_record *lst_syms,
-                          char **p,
-                          char *strings,
-                          unsigned int string_size,
-                          unsigned int hash_size,
-                          unsigned int module_count,
-                          unsigned int som_index,
-                          unsigned int curr_som_offset,
-                          struct som_external_som_entry *som_dict,
-                          unsigned char *hash_table,
-                          struct som_external_lst_symbol_record **last_hash_entry,
-                          bfd *abfd)
+static void add_lst_symbol(struct som_ar_symbol *entry,
+                           struct som_external_lst_symbol_record *curr_lst_sym,
+                           struct som_external_lst_symbol_record *lst_syms,
+                           char **p,
+                           char *strings,
+                           unsigned int string_size,
+                           unsigned int hash_size,
+                           unsigned int module_count,
+                           unsigned int som_index,
+                           unsigned char *hash_table,
+                           struct som_external_lst_symbol_record **last_hash_entry,
+                           bfd *abfd)
 {
-  struct som_misc_symbol_info info;
-  som_bfd_derive_misc_symbol_info(curr_bfd, &sym->symbol, &info);
-  
-  if (!should_include_symbol(&info, sym))
-    return true;
-    
-  update_som_dictionary_if_first(som_dict, som_index, curr_som_offset, curr_bfd);
+  som_symbol_type *sym = entry->sym;
+  unsigned int flags = build_symbol_flags(&entry->info, sym);
   
-  unsigned int symbol_key = som_bfd_ar_symbol_hash(&sym->symbol);
-  unsigned int flags = build_symbol_flags(&info, sym);
+  populate_lst_symbol_record(curr_lst_sym, flags, *p - strings + 4, 
+                            &entry->info, som_index, entry->key);
   
-  populate_lst_symbol_record(*curr_lst_sym, flags, *p - strings + 4, 
-                            &info, som_index, symbol_key);
-  
-  unsigned int symbol_pos = calculate_symbol_position(*curr_lst_sym, lst_syms, 
+  unsigned int symbol_pos = calculate_symbol_position(curr_lst_sym, lst_syms, 
                                                      hash_size, module_count);
   
-  update_hash_chain(symbol_pos, symbol_key, hash_size, hash_table, 
-                   last_hash_entry, *curr_lst_sym);
+  update_hash_chain(symbol_pos, entry->key, hash_size, hash_table, 
+                   last_hash_entry, curr_lst_sym);
   
   *p = update_string_table(abfd, *p, sym->symbol.name);
   
   BFD_ASSERT(*p <= strings + string_size);
-  (*curr_lst_sym)++;
-  
-  return true;
-}
-
-static bool process_bfd_symbols(bfd *curr_bfd,
-                               struct som_external_lst_symbol_record **curr_lst_sym,
-                               struct som_external_lst_symbol_record *lst_syms,
-                               char **p,
-                               char *strings,
-                               unsigned int string_size,
-                               unsigned int hash_size,
-                               unsigned int module_count,
-                               unsigned int som_index,
-                               unsigned int curr_som_offset,
-                               struct som_external_som_entry *som_dict,
-                               unsigned char *hash_table,
-                               struct som_external_lst_symbol_record **last_hash_entry,
-                               bfd *abfd)
-{
-  if (!som_slurp_symbol_table(curr_bfd))
-    return false;
-    
-  som_symbol_type *sym = obj_som_symtab(curr_bfd);
-  unsigned int curr_count = bfd_get_symcount(curr_bfd);
-  
-  for (unsigned int i = 0; i < curr_count; i++, sym++)
-    {
-      if (!process_symbol(curr_bfd, sym, curr_lst_sym, lst_syms, p, strings,
-                         string_size, hash_size, module_count, som_index,
-                         curr_som_offset, som_dict, hash_table, last_hash_entry, abfd))
-        return false;
-    }
-  
-  return true;
 }
 
 static bool write_archive_data(bfd *abfd,
@@ -7404,13 +9836,12 @@ static bool write_archive_data(bfd *abfd,
 
 static bool
 som_bfd_ar_write_symbol_stuff (bfd *abfd,
-                              unsigned int nsyms,
-                              unsigned int string_size,
+                              struct som_ar_symtab *symtab,
                               struct som_external_lst_header lst,
                               unsigned elength)
 {
   char *strings = NULL, *p;
-  struct som_external_lst_symbol_record *lst_syms = NULL, *curr_lst_sym;
+  struct som_external_lst_symbol_record *lst_syms = NULL;
   bfd *curr_bfd;
   unsigned char *hash_table = NULL;
   struct som_external_som_entry *som_dict = NULL;
@@ -7418,6 +9849,9 @@ som_bfd_ar_write_symbol_stuff (bfd *abfd,
   unsigned int curr_som_offset, som_index = 0;
   unsigned int module_count;
   unsigned int hash_size;
+  unsigned int nsyms = symtab->count;
+  unsigned int string_size = symtab->stringsize;
+  unsigned int next = 0;
 
   hash_size = bfd_getb32(lst.hash_size);
   module_count = bfd_getb32(lst.module_count);
@@ -7431,18 +9865,29 @@ som_bfd_ar_write_symbol_stuff (bfd *abfd,
   curr_som_offset = calculate_initial_som_offset(lst, elength);
 
   p = strings;
-  curr_lst_sym = lst_syms;
 
+  /* SYMTAB holds the symbols in member order, so each member's run of
+     them starts where the previous one's stopped.  */
   curr_bfd = abfd->archive_head;
   while (curr_bfd != NULL)
     {
       if (!should_skip_bfd(curr_bfd))
         {
-          if (!process_bfd_symbols(curr_bfd, &curr_lst_sym, lst_syms, &p, strings,
-                                  string_size, hash_size, module_count, som_index,
-                                  curr_som_offset, som_dict, hash_table, 
-                                  last_hash_entry, abfd))
-            goto error_return;
+          som_symbol_type *first = obj_som_symtab(curr_bfd);
+          som_symbol_type *last = first + bfd_get_symcount(curr_bfd);
+
+          for (; next < nsyms; next++)
+            {
+              struct som_ar_symbol *entry = &symtab->syms[next];
+
+              if (entry->sym < first || entry->sym >= last)
+                break;
+              update_som_dictionary_if_first(som_dict, som_index,
+                                             curr_som_offset, curr_bfd);
+              add_lst_symbol(entry, &lst_syms[next], lst_syms, &p, strings,
+                             string_size, hash_size, module_count, som_index,
+                             hash_table, last_hash_entry, abfd);
+            }
             
           curr_som_offset += arelt_size(curr_bfd) + sizeof(struct ar_hdr);
           curr_som_offset = (curr_som_offset + 0x1) & ~(unsigned) 1;
@@ -7450,6 +9895,7 @@ som_bfd_ar_write_symbol_stuff (bfd *abfd,
         }
       curr_bfd = curr_bfd->archive_next;
     }
+  BFD_ASSERT(next == nsyms);
 
   if (!write_archive_data(abfd, hash_table, hash_size, som_dict, module_count,
                          lst_syms, nsyms, strings, string_size))
@@ -7526,18 +9972,103 @@ static unsigned int calculate_lst_checksum(struct som_external_lst_header *lst)
     return csum;
 }
 
-static unsigned int build_lst_header(struct som_external_lst_header *lst,
+/* Use SIZE buckets for the symbol hash table written for SOM archive
+   ABFD, or pick the size from the number of symbols again if SIZE is
+   zero.  SIZE need not be prime, though a prime spreads the symbols
+   best, and may be at most SOM_LST_HASH_SIZE_MAX.  */
+
+bool
+bfd_som_set_lst_hash_size (bfd *abfd, unsigned int size)
+{
+  struct som_archive_data *adata;
+
+  if (bfd_get_flavour (abfd) != bfd_target_som_flavour
+      || bfd_get_format (abfd) != bfd_archive
+      || bfd_ardata (abfd) == NULL)
+    {
+      bfd_set_error (bfd_error_invalid_operation);
+      return false;
+    }
+  if (size > SOM_LST_HASH_SIZE_MAX)
+    {
+      bfd_set_error (bfd_error_bad_value);
+      return false;
+    }
+
+  adata = bfd_ardata (abfd)->tdata;
+  if (adata == NULL)
+    {
+      adata = bfd_zalloc (abfd, sizeof (*adata));
+      if (adata == NULL)
+	return false;
+      bfd_ardata (abfd)->tdata = adata;
+    }
+  adata->hash_size = size;
+  return true;
+}
+
+static bool
+is_prime (unsigned int n)
+{
+  unsigned int d;
+
+  if (n < 2)
+    return false;
+  for (d = 2; d <= n / d; d++)
+    if (n % d == 0)
+      return false;
+  return true;
+}
+
+/* Return the number of hash buckets for archive ABFD with NSYMS
+   symbols: the size set by bfd_som_set_lst_hash_size if any, else the
+   smallest prime giving an average chain length of about
+   SOM_LST_HASH_LOAD, and no less than SOM_LST_HASH_SIZE.  */
+
+static unsigned int
+som_lst_hash_size (bfd *abfd, unsigned int nsyms)
+{
+  const struct som_archive_data *adata = bfd_ardata (abfd)->tdata;
+  unsigned int size;
+
+  if (adata != NULL && adata->hash_size != 0)
+    return adata->hash_size;
+
+  size = nsyms / SOM_LST_HASH_LOAD;
+  if (size <= SOM_LST_HASH_SIZE)
+    return SOM_LST_HASH_SIZE;
+  while (!is_prime (size))
+    size++;
+  return size;
+}
+
+/* Fill in the LST header LST for archive ABFD and return the size of
+   the whole LST, or zero if it does not fit the format.  */
+
+static unsigned int build_lst_header(bfd *abfd,
+                                     struct som_external_lst_header *lst,
                                      unsigned int module_count,
                                      unsigned int nsyms,
                                      unsigned int stringsize)
 {
     unsigned int lst_size = sizeof(struct som_external_lst_header);
+    unsigned int hash_size = som_lst_hash_size(abfd, nsyms);
+    
+    /* Every offset in the LST is 32 bits.  */
+    if (lst_size + 4 * (uint64_t) hash_size
+        + sizeof(struct som_external_som_entry) * (uint64_t) module_count
+        + sizeof(struct som_external_lst_symbol_record) * (uint64_t) nsyms
+        + stringsize > 0xffffffff)
+    {
+        bfd_set_error(bfd_error_file_too_big);
+        return 0;
+    }
     
     init_lst_header_basic(lst);
     
     bfd_putb32(lst_size, &lst->hash_loc);
-    bfd_putb32(SOM_LST_HASH_SIZE, &lst->hash_size);
-    lst_size += 4 * SOM_LST_HASH_SIZE;
+    bfd_putb32(hash_size, &lst->hash_size);
+    lst_size += 4 * hash_size;
     
     bfd_putb32(module_count, &lst->module_count);
     bfd_putb32(module_count, &lst->module_limit);
@@ -7614,10 +10145,12 @@ static bool som_write_armap(bfd *abfd,
                            int stridx ATTRIBUTE_UNUSED)
 {
     struct stat statbuf;
-    unsigned int lst_size, nsyms, stringsize;
+    unsigned int lst_size;
     struct ar_hdr hdr;
     struct som_external_lst_header lst;
     unsigned int module_count;
+    struct som_ar_symtab symtab;
+    bool ok;
     
     if (!get_file_stats(abfd, &statbuf))
         return false;
@@ -7626,20 +10159,27 @@ static bool som_write_armap(bfd *abfd,
     
     module_count = count_som_modules(abfd);
     
-    if (!som_bfd_prep_for_ar_write(abfd, &nsyms, &stringsize))
+    if (!som_bfd_prep_for_ar_write(abfd, &symtab))
+    {
+        free(symtab.syms);
         return false;
+    }
     
-    lst_size = build_lst_header(&lst, module_count, nsyms, stringsize);
+    lst_size = build_lst_header(abfd, &lst, module_count, symtab.count,
+                                symtab.stringsize);
+    if (lst_size == 0)
+    {
+        free(symtab.syms);
+        return false;
+    }
     
     format_ar_header(&hdr, &statbuf, lst_size, bfd_ardata(abfd)->armap_timestamp);
     
-    if (!write_header_data(abfd, &hdr, &lst))
-        return false;
-    
-    if (!som_bfd_ar_write_symbol_stuff(abfd, nsyms, stringsize, lst, elength))
-        return false;
+    ok = (write_header_data(abfd, &hdr, &lst)
+          && som_bfd_ar_write_symbol_stuff(abfd, &symtab, lst, elength));
     
-    return true;
+    free(symtab.syms);
+    return ok;
 }
 
 /* Throw away some malloc'd information for this BFD.  */
@@ -7653,15 +10193,27 @@ static void free_and_nullify(void **ptr)
 static void free_section_data(asection *section)
 {
     section->reloc_count = (unsigned) -1;
-    free_and_nullify((void**)&som_section_data(section)->reloc_stream);
+    if (som_section_data(section) != NULL)
+        release_external_relocs(section);
 }
 
 static void free_som_object_data(bfd *abfd)
 {
     asection *o;
     
-    free_and_nullify((void**)&obj_som_symtab(abfd));
-    free_and_nullify((void**)&obj_som_stringtab(abfd));
+    som_release_raw_symbols(abfd);
+    som_free_contents(abfd);
+    som_free_page_cache(abfd);
+    som_free_output_images(abfd);
+    free_and_nullify((void**)&som_private_data(abfd)->space_strings);
+    free_and_nullify((void**)&som_private_data(abfd)->lazy_symtab);
+    free_and_nullify((void**)&som_private_data(abfd)->sym_hash_buckets);
+    free_and_nullify((void**)&som_private_data(abfd)->sym_hash_chain);
+    free_and_nullify((void**)&som_private_data(abfd)->func_index);
+    som_private_data(abfd)->func_index_count = 0;
+    obj_som_symtab(abfd) = NULL;
+    /* The string table is owned by the BFD (mapped or bfd_alloc'd).  */
+    obj_som_stringtab(abfd) = NULL;
     
     for (o = abfd->sections; o != NULL; o = o->next)
     {
@@ -7686,15 +10238,194 @@ som_bfd_free_cached_info (bfd *abfd)
     return true;
 }
 
+#ifdef SOM_STATS
+/* Add the time since START to *FIELD of ABFD, and trace it if asked
+   to through SOM_TRACE_ENV.  */
+
+static void
+som_stat_time (bfd *abfd, unsigned long *field, long start, const char *what)
+{
+  long elapsed = get_run_time () - start;
+
+  *field += elapsed;
+  if (getenv (SOM_TRACE_ENV) != NULL)
+    fprintf (stderr, "som: %s: %s %ld us\n",
+	     bfd_get_filename (abfd), what, elapsed);
+}
+
+/* The counters of struct som_stats other than the fixup counts, by
+   the names bfd_som_get_stat knows them by.  */
+
+static const struct
+{
+  const char *name;
+  size_t offset;
+} som_stat_fields[] =
+{
+#define SOM_STAT_FIELD(field) { #field, offsetof (struct som_stats, field) }
+  SOM_STAT_FIELD (section_reads),
+  SOM_STAT_FIELD (bytes_read),
+  SOM_STAT_FIELD (seeks),
+  SOM_STAT_FIELD (page_cache_hits),
+  SOM_STAT_FIELD (page_cache_misses),
+  SOM_STAT_FIELD (symbols_decoded),
+  SOM_STAT_FIELD (writes),
+  SOM_STAT_FIELD (bytes_written),
+  SOM_STAT_FIELD (queue_hits),
+  SOM_STAT_FIELD (queue_misses),
+  SOM_STAT_FIELD (begin_writing_time),
+  SOM_STAT_FIELD (finish_writing_time),
+  SOM_STAT_FIELD (encode_fixups_time),
+  SOM_STAT_FIELD (write_fixups_time),
+#undef SOM_STAT_FIELD
+};
+
+/* Return the counters kept for SOM object ABFD, or NULL with the BFD
+   error set if it is not one.  Archives have no SOM private data.  */
+
+static const struct som_stats *
+som_get_stats (bfd *abfd)
+{
+  if (abfd->xvec->flavour != bfd_target_som_flavour
+      || bfd_get_format (abfd) != bfd_object
+      || som_private_data (abfd) == NULL)
+    {
+      bfd_set_error (bfd_error_invalid_operation);
+      return NULL;
+    }
+  return &som_private_data (abfd)->stats;
+}
+
+/* Set *VALUE to the counter called NAME (the name of its struct
+   som_stats field, such as "bytes_read") of SOM object ABFD.  Return
+   false if ABFD is not a SOM object or there is no such counter.  */
+
+bool
+bfd_som_get_stat (bfd *abfd, const char *name, unsigned long *value)
+{
+  const struct som_stats *st = som_get_stats (abfd);
+  unsigned int i;
+
+  if (st == NULL)
+    return false;
+  for (i = 0; i < ARRAY_SIZE (som_stat_fields); i++)
+    if (strcmp (som_stat_fields[i].name, name) == 0)
+      {
+	memcpy (value, (const char *) st + som_stat_fields[i].offset,
+		sizeof (*value));
+	return true;
+      }
+  bfd_set_error (bfd_error_bad_value);
+  return false;
+}
+
+/* Set *DECODED and *ENCODED to the number of fixups of relocation type
+   TYPE decoded from and encoded into SOM object ABFD.  */
+
+bool
+bfd_som_get_fixup_stats (bfd *abfd, unsigned int type,
+			 unsigned long *decoded, unsigned long *encoded)
+{
+  const struct som_stats *st = som_get_stats (abfd);
+
+  if (st == NULL)
+    return false;
+  if (type >= ARRAY_SIZE (st->fixups_decoded))
+    {
+      bfd_set_error (bfd_error_bad_value);
+      return false;
+    }
+  *decoded = st->fixups_decoded[type];
+  *encoded = st->fixups_encoded[type];
+  return true;
+}
+
+/* Print the counters kept for SOM object ABFD to FILE.  */
+
+void
+bfd_som_print_stats (bfd *abfd, FILE *file)
+{
+  const struct som_stats *st = som_get_stats (abfd);
+  unsigned int i;
+
+  if (st == NULL)
+    return;
+
+  fprintf (file, "%s:\n", bfd_get_filename (abfd));
+  for (i = 0; i < ARRAY_SIZE (som_stat_fields); i++)
+    {
+      unsigned long value;
+
+      memcpy (&value, (const char *) st + som_stat_fields[i].offset,
+	      sizeof (value));
+      fprintf (file, "  %s %lu\n", som_stat_fields[i].name, value);
+    }
+  for (i = 0; i < ARRAY_SIZE (st->fixups_decoded); i++)
+    if (st->fixups_decoded[i] != 0 || st->fixups_encoded[i] != 0)
+      fprintf (file, "  fixup type 0x%02x: decoded %lu, encoded %lu\n",
+	       i, st->fixups_decoded[i], st->fixups_encoded[i]);
+}
+#endif /* SOM_STATS */
+
 /* End of miscellaneous support functions.  */
 
 /* Linker support functions.  */
 
+/* Largest code subspace left whole when the linker splits sections.
+   A PA-RISC 1.x branch reaches 256K either way; the margin leaves room
+   for the stubs the linker may add.  PA-RISC 2.0 branches reach 8M.  */
+#define MAX_SUBSPACE_SIZE 240000
+#define MAX_SUBSPACE_SIZE_PA20 (8 * 1024 * 1024 - 16 * 1024)
+
+/* Have the linker split the code subspaces of output BFD ABFD bigger
+   than SIZE bytes, or go back to the limit given by the reach of
+   branches on its architecture if SIZE is zero.  */
+
+bool
+bfd_som_set_split_size (bfd *abfd, bfd_size_type size)
+{
+  if (bfd_get_flavour (abfd) != bfd_target_som_flavour
+      || bfd_get_format (abfd) != bfd_object)
+    {
+      bfd_set_error (bfd_error_invalid_operation);
+      return false;
+    }
+
+  som_private_data (abfd)->split_size = size;
+  return true;
+}
+
+/* Whether SEC holds code, going by what its subspace attributes say
+   if it has them.  */
+
+static bool
+som_is_code_subspace (asection *sec)
+{
+  const struct som_copyable_section_data_struct *copy_data
+    = som_section_data (sec)->copy_data;
+
+  if ((sec->flags & SEC_CODE) != 0)
+    return true;
+  return copy_data != NULL && (copy_data->access_control_bits >> 4) >= 2;
+}
+
 static bool
-som_bfd_link_split_section (bfd *abfd ATTRIBUTE_UNUSED, asection *sec)
+som_bfd_link_split_section (bfd *abfd, asection *sec)
 {
-  #define MAX_SUBSPACE_SIZE 240000
-  return som_is_subspace (sec) && sec->size > MAX_SUBSPACE_SIZE;
+  bfd_size_type limit;
+
+  /* Splitting only helps branches reach their targets, so leave data
+     subspaces and everything that is not a subspace alone.  */
+  if (!som_is_subspace (sec) || !som_is_code_subspace (sec))
+    return false;
+
+  if (som_private_data (abfd)->split_size != 0)
+    limit = som_private_data (abfd)->split_size;
+  else if (bfd_get_mach (abfd) >= bfd_mach_hppa20)
+    limit = MAX_SUBSPACE_SIZE_PA20;
+  else
+    limit = MAX_SUBSPACE_SIZE;
+  return sec->size > limit;
 }
 
 #define som_find_line				_bfd_nosymbols_find_line